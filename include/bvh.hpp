@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include <vec3.hpp>
+#include <mesh.hpp>
+#include <frustum.hpp>
+
+// Bounding volume hierarchy over scene meshes, world space boxes.
+// Moved meshes are refit in place, the tree is rebuilt when meshes are
+// added or removed, or when refits have made it too loose
+class BVH
+{
+public:
+    // Bring the tree up to date with meshes. Only meshes whose transform or
+    // bounds changed since the last call are refit
+    void Update(std::vector<Mesh> &meshes);
+
+    // Indices of meshes whose box overlaps the query, in no particular order
+    void QueryBox(Vec3 min, Vec3 max, std::vector<int> &out);
+    void QueryRadius(Vec3 center, float radius, std::vector<int> &out);
+    void QueryFrustum(Frustum &frustum, std::vector<int> &out);
+
+    // Same as QueryFrustum, also telling which meshes are fully inside:
+    // inside[i] for every i in out. Whole subtrees inside the frustum are
+    // taken without testing their meshes
+    void CullFrustum(Frustum &frustum, std::vector<int> &out, std::vector<bool> &inside);
+
+private:
+    // Leaves hold up to LEAF_SIZE meshes, items[first, first + count).
+    // Inner nodes have count 0 and children first and first + 1
+    static const int LEAF_SIZE = 4;
+    struct Node
+    {
+        Vec3 min, max;
+        int first = 0, count = 0;
+        int parent = -1;
+    };
+    std::vector<Node> nodes;
+    std::vector<int> items;
+
+    // What each mesh's box was computed from, to spot changes
+    struct Entry
+    {
+        Vec3 position, rotation, size;
+        Vec3 boundsMin, boundsMax;
+        Vec3 min, max;
+        int leaf = -1;
+    };
+    std::vector<Entry> entries;
+
+    // Sum of node surface areas, now and right after the last build
+    float cost = 0.0f, builtCost = 0.0f;
+
+    void Rebuild(std::vector<Mesh> &meshes);
+    void Build(int node, int first, int count);
+    void Refit(int node);
+    void FitNode(int node);
+
+    template <typename Overlaps>
+    void Query(Overlaps overlaps, std::vector<int> &out);
+};
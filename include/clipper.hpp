@@ -0,0 +1,40 @@
+#pragma once
+
+#include <mat4.hpp>
+#include <texuv.hpp>
+
+// Outcode bits, one for each clip plane a vertex is outside of
+#define CLIP_LEFT 0x01
+#define CLIP_RIGHT 0x02
+#define CLIP_TOP 0x04
+#define CLIP_BOTTOM 0x08
+#define CLIP_NEAR 0x10
+#define CLIP_FAR 0x20
+
+// A triangle clipped by the six planes keeps at most one more vertex per plane
+#define CLIP_MAX_VERTICES 9
+
+// Clip space position, and the attributes interpolated along with it
+struct ClipVertex
+{
+    float x, y, z, w;
+    TexUV t;
+    float r, g, b;
+};
+
+// Planes in homogeneous clip space, in outcode bit order. The distance to
+// plane i is (x * plane[i][0] + y * plane[i][1]) + (z * plane[i][2] + w * plane[i][3]),
+// negative outside
+struct ClipPlanes
+{
+    float plane[6][4];
+
+    // Sides on the guard band around a width x height screen, near and far
+    // planes at those view distances, for the projection proj
+    static ClipPlanes FromProjection(const Mat4 &proj, float near, float far, int width, int height);
+};
+
+// Sutherland-Hodgman clip of the convex polygon in (count vertices) against
+// the planes in mask, into out (CLIP_MAX_VERTICES). Returns how many vertices
+// are left, less than 3 when the polygon is gone
+int ClipPolygon(const ClipPlanes &planes, int mask, const ClipVertex *in, int count, ClipVertex *out);
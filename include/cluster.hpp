@@ -0,0 +1,42 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <cmath>
+#include <vector>
+
+#include <vec3.hpp>
+
+// Triangles per cluster, at most
+#define CLUSTER_SIZE 64
+
+// Run of neighbouring triangles [first, first + count) with a sphere around
+// them and a cone around their face normals (cosine and sine of its half
+// angle), model space
+struct MeshCluster
+{
+    int first = 0, count = 0;
+    Vec3 center = {0.0f, 0.0f, 0.0f};
+    float radius = 0.0f;
+    Vec3 axis = {0.0f, 0.0f, 0.0f};
+    float coneCos = 0.0f, coneSin = 1.0f;
+
+    // Every triangle faces away from eye. The cone can't point any of its
+    // normals towards a point of the sphere as seen from eye
+    bool BackFacing(const Vec3 &eye) const
+    {
+        if (coneCos <= 0.0f) return false;
+
+        float vx = center.x - eye.x, vy = center.y - eye.y, vz = center.z - eye.z;
+        float along = vx * axis.x + vy * axis.y + vz * axis.z;
+        if (along <= radius) return false;
+
+        float across = std::sqrt(std::max(vx * vx + vy * vy + vz * vz - along * along, 0.0f));
+        return along * coneCos - across * coneSin >= radius;
+    }
+};
+
+// Reorder the triangles of an indexed list (indices, uvIndices, normalIndices
+// if it has one per corner, and colors together) so that each cluster is a
+// connected patch, then fill the unit face normal of each triangle and the clusters
+void BuildClusters(const std::vector<Vec3> &positions, std::vector<int> &indices, std::vector<int> &uvIndices, std::vector<int> &normalIndices,
+                   std::vector<SDL_Color> &colors, std::vector<Vec3> &normals, std::vector<MeshCluster> &clusters);
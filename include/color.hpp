@@ -0,0 +1,23 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+// Pixel format used by the engine framebuffer
+#define FRAMEBUFFER_FORMAT SDL_PIXELFORMAT_ARGB8888
+
+// Convert color to a framebuffer pixel (ARGB8888)
+inline Uint32 PackColor(SDL_Color color)
+{
+    return (Uint32)color.a << 24 | (Uint32)color.r << 16 | (Uint32)color.g << 8 | (Uint32)color.b;
+}
+
+// Convert framebuffer pixel (ARGB8888) back to color
+inline SDL_Color UnpackColor(Uint32 pixel)
+{
+    return {
+        (Uint8)(pixel >> 16),
+        (Uint8)(pixel >> 8),
+        (Uint8)pixel,
+        (Uint8)(pixel >> 24)
+    };
+}
@@ -4,6 +4,24 @@
 #include <string>
 
 #include <structs.hpp>
+#include <rasterizer.hpp>
+#include <radix_sort.hpp>
+#include <vertex_stream.hpp>
+#include <frustum.hpp>
+#include <bvh.hpp>
+#include <lighting.hpp>
+#include <thread_pool.hpp>
+
+// Order the frame's triangles are drawn in
+enum class RenderOrder
+{
+    // Painter's order, far to near. Right for flat triangles, which skip the depth test
+    BackToFront,
+
+    // Near to far, lets the depth test reject hidden pixels early. Flat
+    // triangles are depth tested in this order
+    FrontToBack
+};
 
 class Engine3D
 {
@@ -13,6 +31,11 @@ public:
     ~Engine3D();
     bool init(int width = 600, int height = 600);
 
+    // Initialize without a window, for rendering off screen. Frames are drawn
+    // with RenderFrame (setup is left to the caller) and read back with
+    // GetColorBuffer
+    bool initHeadless(int width = 600, int height = 600);
+
     // Method to start engine
     void run();
 
@@ -28,6 +51,13 @@ public:
     int getWidth() { return _width; }
     int getHeight() { return _height; }
 
+    // Draw one frame into the color buffer without presenting it
+    void RenderFrame() { draw(); }
+
+    // Color buffer of the last frame, getWidth() * getHeight() pixels in
+    // FRAMEBUFFER_FORMAT
+    const Uint32 *GetColorBuffer() { return colorBuffer; }
+
     // Mouse
     Vec2 GetMousePos();
     MouseState mouseState;
@@ -46,6 +76,15 @@ public:
     // List of scene meshes
     std::vector<Mesh> sceneMeshes;
 
+    // Indices of scene meshes whose world box overlaps a box, a sphere or a
+    // world space frustum, answered by the scene tree
+    std::vector<int> QueryBox(Vec3 min, Vec3 max);
+    std::vector<int> QueryRadius(Vec3 center, float radius);
+    std::vector<int> QueryFrustum(Frustum frustum);
+
+    // Camera frustum in world space
+    Frustum ViewFrustum();
+
     // Drawing
     void Fill(SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
     void RenderPoint(Vec2 p, SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
@@ -53,16 +92,47 @@ public:
     void RenderTriangle(Vec2 v0, Vec2 v1, Vec2 v2, SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
     void FillTriangle(Vec2 v0, Vec2 v1, Vec2 v2, SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
     void FillTriangleOld(Vec2 v0, Vec2 v1, Vec2 v2, SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
-    void TexturedTriangle(Vec2 p0, TexUV tex0, Vec2 p1, TexUV tex1, Vec2 p2, TexUV tex2, Texture texture, SDL_Color color = {0, 0, 0, 0});
+    void TexturedTriangle(Vec2 p0, TexUV tex0, Vec2 p1, TexUV tex1, Vec2 p2, TexUV tex2, const Texture &texture, SDL_Color color = {0, 0, 0, 0});
     // Rect
     void RenderRect(Vec2 pos, Vec2 size, int thickness = 0, SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
     // Circle
     void RenderCircle(Vec2 pos, int radius, SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
     void FillCircle(Vec2 pos, int radius, SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE});
 
+    // Triangle rasterizer, picks SIMD path from CPU features
+    Rasterizer rasterizer;
+
+    // Rasterize depth and triangle IDs first, then shade each visible pixel
+    // once. Same image, but shading no longer pays for overdraw
+    bool visibilityBuffer = false;
+
+    // Least light any flat face gets, in linear RGB (1 is its full color).
+    // All faces get this much when no light was added
+    float ambientLight = 0.1f;
+
+    // Light flat meshes per vertex normal and blend the colors over each
+    // triangle (Gouraud), instead of one color per face
+    bool smoothShading = false;
+
+    // Largest simplification error allowed on screen, in pixels, when picking
+    // mesh levels of detail. 0 draws every mesh at full detail
+    float lodPixelError = 0.5f;
+
+    // Drawing order of the frame-wide render queue
+    RenderOrder renderOrder = RenderOrder::BackToFront;
+
+    // Draw triangle edges on top of the scene, hidden behind the triangles
+    // when wireframeDepthTest is set
+    bool drawWireframe = false;
+    bool wireframeDepthTest = true;
+
     // Performance related
     void SetFPS(int fps);
 
+    // Threads used to rasterize the scene (0 or less uses every core)
+    void SetThreadCount(int count);
+    int GetThreadCount();
+
     // Window title
     std::string windowTitle = "SDL Engine 3D";
 
@@ -76,17 +146,85 @@ private:
     // Default method for drawing all scene meshes
     void draw();
 
+    // Frame buffers, tiles, threads and projection for a width x height frame
+    void InitFrame(int width, int height);
+
+    // Move triangles added one by one into the indexed arrays, then fill in
+    // what drawing needs: vertex normals when missing, levels of detail
+    // (rebuilt if it had some) and clusters
+    void PrepareMesh(Mesh &mesh);
+
     // SDL Render data
     SDL_Window* window;
     SDL_Renderer* renderer;
     SDL_Surface* windowSurface;
+    SDL_Texture* frameTexture;
 
     // Window data
     int _width = 0, _height = 0;
 
-    // Depth buffer
+    // Color and depth buffers (cache-line aligned, one entry per pixel)
+    Uint32 *colorBuffer = NULL;
     float *depthBuffer = NULL;
 
+    // Triangle ID per pixel, used when visibilityBuffer is on
+    Uint32 *idBuffer = NULL;
+
+    // Depth pyramid: farthest depth per 8x8 block and per 64x64 tile
+    float *hizBlocks = NULL;
+    float *hizTiles = NULL;
+    int hizBlocksX = 0, hizBlocksY = 0;
+    int hizTilesX = 0, hizTilesY = 0;
+
+    // Write a horizontal run of pixels / a line into the color buffer now
+    void DrawSpan(int x0, int x1, int y, Uint32 color);
+    void DrawLine(int x0, int y0, int x1, int y1, Uint32 color);
+
+    // Color and depth buffers as a full screen render target
+    RenderTarget ScreenTarget();
+
+    // Hierarchy over sceneMeshes, refit as meshes move. Meshes found in view
+    // each frame, and which of them are fully inside
+    BVH sceneTree;
+    std::vector<int> visibleMeshes;
+    std::vector<bool> visibleInside;
+
+    // Post-transform cache of the mesh being drawn, each unique vertex in
+    // world, view and screen space, and its clip space outcodes
+    VertexStream worldVertices, viewVertices, screenVertices;
+    std::vector<Uint8> screenCodes;
+
+    // Faces of the mesh being drawn that face the camera. The normals lit
+    // (of those faces, or the level's vertex normals when smooth) in model and world
+    // space, and the light they get
+    std::vector<int> visibleFaces;
+    VertexStream modelNormals, worldNormals;
+    std::vector<float> normalLight;
+
+    // Projected and clipped triangles of the mesh being drawn, before queuing
+    std::vector<Triangle> trianglesToRaster;
+
+    // Triangles of the current frame, queued from every mesh then sorted
+    // into drawing order by key
+    std::vector<RasterTriangle> rasterQueue;
+    std::vector<SortItem> rasterKeys, sortScratch;
+    std::vector<RasterTriangle> sortedQueue;
+
+    // Screen is split in tiles, each one holding the queue indices that touch it
+    int tilesX = 0, tilesY = 0;
+    std::vector<TriangleSetup> rasterSetups;
+    std::vector<std::vector<int>> tileBins;
+    ThreadPool threadPool;
+
+    // Bin queued triangles into tiles and draw the tiles in parallel
+    void RasterizeQueue();
+
+    // Lines of the current frame (wireframe), drawn in one pass after the
+    // triangles, binned into the same tiles
+    std::vector<RasterLine> lineQueue;
+    std::vector<std::vector<int>> lineBins;
+    void DrawLineQueue();
+
     // Mouse state
     void MouseUp(SDL_MouseButtonEvent button);
     void MouseDown(SDL_MouseButtonEvent button);
@@ -102,8 +240,7 @@ private:
 
     // Rendering related
     std::vector<Light> lights;
-
-    bool drawWireframe = false;
+    std::vector<float> lightData;
 
     // Time elapsed since engine start
     float timeElapsed = 0.0f;
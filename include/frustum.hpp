@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vec3.hpp>
+#include <mat4.hpp>
+
+// Where bounds lie against the frustum
+enum class FrustumTest
+{
+    Outside,
+    Intersects,
+    Inside
+};
+
+// View space frustum, six planes facing inwards
+class Frustum
+{
+public:
+    // Plane n.p + d = 0, n is unit length and points inside
+    struct Plane
+    {
+        Vec3 n;
+        float d;
+    };
+    Plane planes[6];
+
+    // Sides from the projection, at the screen edges. Near and far planes at
+    // those view distances
+    static Frustum FromProjection(const Mat4 &proj, float near, float far);
+
+    // Same volume for points p with m * p in this frustum, e.g. the view
+    // frustum in world space from the view matrix. m must not scale
+    Frustum Transformed(const Mat4 &m);
+
+    // Sphere, cheap but loose
+    FrustumTest TestSphere(Vec3 center, float radius);
+
+    // Convex hull of points, e.g. the eight corners of a transformed box
+    FrustumTest TestPoints(const Vec3 *points, int count);
+
+    // Axis aligned box
+    FrustumTest TestBox(Vec3 min, Vec3 max);
+};
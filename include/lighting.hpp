@@ -0,0 +1,23 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+
+// Steps of the linear to sRGB table
+#define LINEAR_STEPS 4096
+
+// Light is added up in linear RGB. Colors are stored as 8-bit sRGB, these
+// tables convert both ways without pow per channel
+extern float srgbToLinear[256];
+extern Uint8 linearToSRGB[LINEAR_STEPS + 1];
+
+// Color lit by light (1 keeps it as it is), clamped to white
+inline SDL_Color ShadeColor(SDL_Color color, float light)
+{
+    auto channel = [light](Uint8 c)
+    {
+        float linear = std::min(srgbToLinear[c] * light, 1.0f);
+        return linearToSRGB[(int)(linear * LINEAR_STEPS + 0.5f)];
+    };
+    return {channel(color.r), channel(color.g), channel(color.b), SDL_ALPHA_OPAQUE};
+}
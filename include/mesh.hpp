@@ -4,8 +4,39 @@
 #include <vector>
 
 #include <vec3.hpp>
+#include <mat4.hpp>
 #include <texture.hpp>
 #include <triangle.hpp>
+#include <cluster.hpp>
+
+// Simplified levels are taken down to this many triangles
+#define LOD_MIN_TRIANGLES 256
+
+// A level is kept until its error on screen grows past this many times the
+// limit, so meshes near the switching distance don't flip back and forth
+#define LOD_HYSTERESIS 1.5f
+
+// Faces meeting at a sharper angle than this, in degrees, keep separate
+// smoothed vertex normals, so box edges and cylinder rims stay hard
+#define CREASE_ANGLE 60.0f
+
+// Simplified copy of a mesh's geometry, indexing the same UVs and vertex normals
+struct MeshLOD
+{
+    std::vector<Vec3> positions;
+    std::vector<int> indices;
+    std::vector<int> uvIndices;
+    std::vector<int> normalIndices;
+    std::vector<SDL_Color> colors;
+    std::vector<Vec3> normals;
+    std::vector<MeshCluster> clusters;
+
+    // Vertex normals normalIndices uses, [normalBegin, normalEnd)
+    int normalBegin = 0, normalEnd = 0;
+
+    // How far the surface may be from the full detail one, model units
+    float error = 0.0f;
+};
 
 class Mesh
 {
@@ -13,15 +44,86 @@ public:
     Mesh();
     ~Mesh();
 
+    // Indexed geometry: triangle i uses positions[indices[3 * i + k]] and
+    // uvs[uvIndices[3 * i + k]] for its corners k = 0..2, and colors[i]
+    std::vector<Vec3> positions;
+    std::vector<TexUV> uvs;
+    std::vector<int> indices;
+    std::vector<int> uvIndices;
+    std::vector<SDL_Color> colors;
+
+    // Unit vertex normals, corner k of triangle i uses
+    // vertexNormals[normalIndices[3 * i + k]]. Read from the OBJ file, or
+    // smoothed by ComputeVertexNormals (addMesh does it when they're missing)
+    std::vector<Vec3> vertexNormals;
+    std::vector<int> normalIndices;
+
+    // Vertex normals the full detail triangles use, [normalBegin, normalEnd).
+    // Levels keep their own range. Kept by BuildClusters and BuildLODs
+    int normalBegin = 0, normalEnd = 0;
+
+    // Unit face normal of each triangle, and triangles grouped in clusters
+    // for culling a whole back-facing cluster at once. Kept by BuildClusters
+    std::vector<Vec3> normals;
+    std::vector<MeshCluster> clusters;
+
+    // Triangles given one by one, moved into the indexed arrays by BuildIndices
+    // (addMesh does it, and the engine again for triangles added later)
     std::vector<Triangle> tris;
+
+    // Model space bounds of positions, kept by ComputeBounds. Call it again
+    // after editing positions directly
+    Vec3 boundsMin = {0.0f, 0.0f, 0.0f};
+    Vec3 boundsMax = {0.0f, 0.0f, 0.0f};
+    Vec3 boundsCenter = {0.0f, 0.0f, 0.0f};
+    float boundsRadius = 0.0f;
+
+    // Levels of detail, each with about half the triangles of the one before.
+    // Level 0 is the mesh itself, level i > 0 is lods[i - 1]. Build them again
+    // after editing the geometry
+    std::vector<MeshLOD> lods;
+    int lodLevel = 0;
+
     Vec3 position = {0.0f, 0.0f, 0.0f};
     Vec3 rotation = {0.0f, 0.0f, 0.0f};
     Vec3 size = {1.0f, 1.0f, 1.0f};
     Texture texture;
 
+    // Model to world transform from rotation and position (size is applied
+    // to positions before it)
+    Mat4 WorldMatrix();
+
     // Set color of all triangles
     void SetColor(SDL_Color color);
 
+    // Number of indexed triangles
+    int TriangleCount() { return (int)indices.size() / 3; }
+
+    // Append a triangle to the indexed arrays
+    void AddTriangle(int p0, int p1, int p2, int t0, int t1, int t2, SDL_Color color = {255, 255, 255, SDL_ALPHA_OPAQUE});
+
+    // Move tris into the indexed arrays, sharing equal positions and UVs
+    void BuildIndices();
+
+    // Simplify into up to count levels, stopping at LOD_MIN_TRIANGLES.
+    // FromOBJFile does it, meshes too small get no levels
+    void BuildLODs(int count = 4);
+
+    // Pick lodLevel for a frame where one model unit covers unitPixels pixels:
+    // the coarsest level whose error shows as at most maxError pixels
+    int SelectLOD(float unitPixels, float maxError);
+
+    // Smooth vertex normals, the average of the faces around each position,
+    // split where faces meet past CREASE_ANGLE, for the mesh and its levels
+    void ComputeVertexNormals();
+
+    // Reorder triangles into clusters and compute face normals, for the mesh
+    // and its levels. addMesh does it, call it again after editing the geometry
+    void BuildClusters();
+
+    // Bounding box and sphere (around the box center) of positions
+    void ComputeBounds();
+
     // Load from .obj file
     static Mesh FromOBJFile(std::string fileName);
 
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <cstring>
+#include <vector>
+
+// Sort key and the index of the item it belongs to
+struct SortItem
+{
+    Uint32 key;
+    int index;
+};
+
+// Key that orders floats like the values themselves (ascending)
+inline Uint32 FloatSortKey(float f)
+{
+    Uint32 bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+// Stable LSD radix sort on key, 8 bits per pass. Passes where every key has
+// the same byte are skipped. scratch is resized as needed
+void RadixSort(std::vector<SortItem> &items, std::vector<SortItem> &scratch);
@@ -0,0 +1,586 @@
+#pragma once
+
+// Rasterizer inner loops, shared by every instruction set.
+// This header is compiled once per path (rasterizer.cpp for scalar and SSE2,
+// rasterizer_avx2.cpp with -mavx2), so everything below the declarations
+// lives in an anonymous namespace and must not call shared inline helpers.
+
+#include <SDL2/SDL.h>
+#include <cmath>
+
+#include <rasterizer.hpp>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Fetch texels for the lanes set in mask, wrapped or clamped as the sampler
+// says (defined in rasterizer.cpp)
+void FetchTexels(const TriangleSetup &s, const int *x, const int *y, int mask, int count, Uint32 *out);
+
+// Bilinear taps for the lanes set in mask. x and y are texel coordinates in
+// 24.8 fixed point, BILINEAR_OFFSET texels to the right and down. Fills the
+// 2x2 texels around each (wrapped or clamped) and the 8-bit weights of the
+// right and bottom ones. Lanes outside mask get zeros (defined in rasterizer.cpp)
+void FetchQuads(const TriangleSetup &s, const int *x, const int *y, int mask, int count,
+                Uint32 *topLeft, Uint32 *topRight, Uint32 *bottomLeft, Uint32 *bottomRight, int *weightX, int *weightY);
+
+// Pack the blended channels for the lanes set in mask, clamped to 0..255
+// (defined in rasterizer.cpp)
+void BlendColors(const int *r, const int *g, const int *b, int mask, int count, Uint32 *out);
+
+// Pixels [x0, x1] of row y covered by the triangle, inside its bounding box.
+// Exact, same pixels as the edge test. Empty rows give x0 > x1
+void RowCoverage(const TriangleSetup &s, int y, int &x0, int &x1);
+
+// Entry points of each path
+void RasterizeScalar(const RenderTarget &target, const TriangleSetup &s);
+void RasterizeSSE2(const RenderTarget &target, const TriangleSetup &s);
+void RasterizeAVX2(const RenderTarget &target, const TriangleSetup &s);
+
+namespace
+{
+
+// One pixel at a time, reference for the SIMD paths
+struct LanesScalar
+{
+    static const int Count = 1;
+    typedef float Float;
+    typedef bool Mask;
+    typedef long long Int;
+
+    static Float Set(float f) { return f; }
+    static Float Ramp(float f) { return f; }
+    static Float Add(Float a, Float b) { return a + b; }
+    static Float Mul(Float a, Float b) { return a * b; }
+    static Float Div(Float a, Float b) { return a / b; }
+
+    static Mask Less(Float a, Float b) { return a < b; }
+    static Mask And(Mask a, Mask b) { return a && b; }
+    static Mask FirstN(int n) { return n > 0; }
+    static int Bits(Mask m) { return m ? 1 : 0; }
+
+    // Edge values, 64 bits wide so any triangle fits
+    static Int Ramp(long long base, long long) { return base; }
+    static Int Or(Int a, Int b) { return a | b; }
+    static Mask NotNegative(Int a) { return a >= 0; }
+
+    static void ToInt(Float f, int *out) { out[0] = (int)f; }
+
+    static Float Load(const float *p, int) { return p[0]; }
+    static void Fill(Uint32 *p, const Uint32 *colors, int) { p[0] = colors[0]; }
+    static void Store(float *p, Mask m, Float f, int) { if (m) p[0] = f; }
+    static void Store(Uint32 *p, Mask m, const Uint32 *colors, int) { if (m) p[0] = colors[0]; }
+
+    // Bilinear blend of 2x2 texels per lane, 8-bit weights, integer math only
+    static void Bilerp(const Uint32 *t00, const Uint32 *t10, const Uint32 *t01, const Uint32 *t11,
+                       const int *wx, const int *wy, Uint32 *out)
+    {
+        Uint32 result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            Uint32 a = t00[0] >> shift & 0xFF, b = t10[0] >> shift & 0xFF;
+            Uint32 c = t01[0] >> shift & 0xFF, d = t11[0] >> shift & 0xFF;
+            Uint32 top = (a * (256 - wx[0]) + b * wx[0] + 128) >> 8;
+            Uint32 bottom = (c * (256 - wx[0]) + d * wx[0] + 128) >> 8;
+            result |= ((top * (256 - wy[0]) + bottom * wy[0] + 128) >> 8) << shift;
+        }
+        out[0] = result;
+    }
+};
+
+#if defined(__SSE2__)
+// Four pixels at a time
+struct LanesSSE2
+{
+    static const int Count = 4;
+    typedef __m128 Float;
+    typedef __m128 Mask;
+    typedef __m128i Int;
+
+    static Float Set(float f) { return _mm_set1_ps(f); }
+    static Float Ramp(float f) { return _mm_add_ps(_mm_set1_ps(f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)); }
+    static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+    static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+
+    static Mask Less(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+    static Mask And(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    static Mask FirstN(int n)
+    {
+        return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(n), _mm_setr_epi32(0, 1, 2, 3)));
+    }
+    static int Bits(Mask m) { return _mm_movemask_ps(m); }
+
+    // Edge values in 32 bits, lanes past the end of the block may wrap
+    static Int Ramp(long long base, long long step)
+    {
+        unsigned int b = (unsigned int)base, d = (unsigned int)step;
+        return _mm_setr_epi32((int)b, (int)(b + d), (int)(b + 2 * d), (int)(b + 3 * d));
+    }
+    static Int Or(Int a, Int b) { return _mm_or_si128(a, b); }
+    static Mask NotNegative(Int a) { return _mm_castsi128_ps(_mm_cmpgt_epi32(a, _mm_set1_epi32(-1))); }
+
+    static void ToInt(Float f, int *out) { _mm_storeu_si128((__m128i *)out, _mm_cvttps_epi32(f)); }
+
+    static Float Load(const float *p, int n)
+    {
+        if (n == Count) return _mm_loadu_ps(p);
+
+        float tmp[Count] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < n; i++) tmp[i] = p[i];
+        return _mm_loadu_ps(tmp);
+    }
+
+    // First n pixels, no mask
+    static void Fill(Uint32 *p, const Uint32 *colors, int n)
+    {
+        if (n == Count)
+        {
+            _mm_storeu_si128((__m128i *)p, _mm_loadu_si128((const __m128i *)colors));
+            return;
+        }
+        for (int i = 0; i < n; i++) p[i] = colors[i];
+    }
+
+    static void Store(float *p, Mask m, Float f, int n)
+    {
+        if (n == Count)
+        {
+            __m128 old = _mm_loadu_ps(p);
+            _mm_storeu_ps(p, _mm_or_ps(_mm_and_ps(m, f), _mm_andnot_ps(m, old)));
+            return;
+        }
+
+        // Never touch pixels past the end of the block
+        alignas(16) float tmp[Count];
+        _mm_store_ps(tmp, f);
+        int bits = Bits(m);
+        for (int i = 0; i < n; i++)
+            if (bits & (1 << i)) p[i] = tmp[i];
+    }
+
+    static void Store(Uint32 *p, Mask m, const Uint32 *colors, int n)
+    {
+        if (n == Count)
+        {
+            __m128i mi = _mm_castps_si128(m);
+            __m128i old = _mm_loadu_si128((const __m128i *)p);
+            __m128i col = _mm_loadu_si128((const __m128i *)colors);
+            _mm_storeu_si128((__m128i *)p, _mm_or_si128(_mm_and_si128(mi, col), _mm_andnot_si128(mi, old)));
+            return;
+        }
+
+        int bits = Bits(m);
+        for (int i = 0; i < n; i++)
+            if (bits & (1 << i)) p[i] = colors[i];
+    }
+
+    // a * (256 - w) + b * w, rounded, per 16-bit channel
+    static __m128i Lerp(__m128i a, __m128i b, __m128i w)
+    {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(_mm_set1_epi16(256), w)), _mm_mullo_epi16(b, w));
+        return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+    }
+
+    // Channels of two pixels widened to 16 bits (low or high half), and
+    // their weights repeated over the four channels
+    static void Bilerp(const Uint32 *t00, const Uint32 *t10, const Uint32 *t01, const Uint32 *t11,
+                       const int *wx, const int *wy, Uint32 *out)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i a = _mm_loadu_si128((const __m128i *)t00), b = _mm_loadu_si128((const __m128i *)t10);
+        __m128i c = _mm_loadu_si128((const __m128i *)t01), d = _mm_loadu_si128((const __m128i *)t11);
+
+        __m128i x = _mm_loadu_si128((const __m128i *)wx), y = _mm_loadu_si128((const __m128i *)wy);
+        x = _mm_unpacklo_epi16(_mm_packs_epi32(x, x), _mm_packs_epi32(x, x));
+        y = _mm_unpacklo_epi16(_mm_packs_epi32(y, y), _mm_packs_epi32(y, y));
+        __m128i xLow = _mm_unpacklo_epi32(x, x), xHigh = _mm_unpackhi_epi32(x, x);
+        __m128i yLow = _mm_unpacklo_epi32(y, y), yHigh = _mm_unpackhi_epi32(y, y);
+
+        __m128i low = Lerp(Lerp(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), xLow),
+                           Lerp(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero), xLow), yLow);
+        __m128i high = Lerp(Lerp(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), xHigh),
+                            Lerp(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero), xHigh), yHigh);
+        _mm_storeu_si128((__m128i *)out, _mm_packus_epi16(low, high));
+    }
+};
+#endif
+
+#if defined(__AVX2__)
+// Eight pixels at a time
+struct LanesAVX2
+{
+    static const int Count = 8;
+    typedef __m256 Float;
+    typedef __m256 Mask;
+    typedef __m256i Int;
+
+    static Float Set(float f) { return _mm256_set1_ps(f); }
+    static Float Ramp(float f)
+    {
+        return _mm256_add_ps(_mm256_set1_ps(f), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+    }
+    static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+
+    static Mask Less(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask And(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static Mask FirstN(int n)
+    {
+        return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    }
+    static int Bits(Mask m) { return _mm256_movemask_ps(m); }
+
+    // Edge values in 32 bits, lanes past the end of the block may wrap
+    static Int Ramp(long long base, long long step)
+    {
+        __m256i steps = _mm256_mullo_epi32(_mm256_set1_epi32((int)step), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        return _mm256_add_epi32(_mm256_set1_epi32((int)base), steps);
+    }
+    static Int Or(Int a, Int b) { return _mm256_or_si256(a, b); }
+    static Mask NotNegative(Int a) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, _mm256_set1_epi32(-1))); }
+
+    static void ToInt(Float f, int *out) { _mm256_storeu_si256((__m256i *)out, _mm256_cvttps_epi32(f)); }
+
+    static Float Load(const float *p, int n)
+    {
+        if (n == Count) return _mm256_loadu_ps(p);
+        return _mm256_maskload_ps(p, _mm256_castps_si256(FirstN(n)));
+    }
+
+    // First n pixels, no mask
+    static void Fill(Uint32 *p, const Uint32 *colors, int n)
+    {
+        __m256i col = _mm256_loadu_si256((const __m256i *)colors);
+        if (n == Count)
+            _mm256_storeu_si256((__m256i *)p, col);
+        else
+            _mm256_maskstore_epi32((int *)p, _mm256_castps_si256(FirstN(n)), col);
+    }
+
+    // Masked stores never touch lanes outside the mask
+    static void Store(float *p, Mask m, Float f, int)
+    {
+        _mm256_maskstore_ps(p, _mm256_castps_si256(m), f);
+    }
+
+    static void Store(Uint32 *p, Mask m, const Uint32 *colors, int)
+    {
+        __m256i col = _mm256_loadu_si256((const __m256i *)colors);
+        _mm256_maskstore_epi32((int *)p, _mm256_castps_si256(m), col);
+    }
+
+    // a * (256 - w) + b * w, rounded, per 16-bit channel
+    static __m256i Lerp(__m256i a, __m256i b, __m256i w)
+    {
+        __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, _mm256_sub_epi16(_mm256_set1_epi16(256), w)), _mm256_mullo_epi16(b, w));
+        return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+    }
+
+    // Same as SSE2 within each 128-bit half: the low unpacks hold pixels
+    // 0, 1, 4, 5 and the high ones 2, 3, 6, 7
+    static void Bilerp(const Uint32 *t00, const Uint32 *t10, const Uint32 *t01, const Uint32 *t11,
+                       const int *wx, const int *wy, Uint32 *out)
+    {
+        __m256i zero = _mm256_setzero_si256();
+        __m256i a = _mm256_loadu_si256((const __m256i *)t00), b = _mm256_loadu_si256((const __m256i *)t10);
+        __m256i c = _mm256_loadu_si256((const __m256i *)t01), d = _mm256_loadu_si256((const __m256i *)t11);
+
+        __m256i x = _mm256_loadu_si256((const __m256i *)wx), y = _mm256_loadu_si256((const __m256i *)wy);
+        x = _mm256_unpacklo_epi16(_mm256_packs_epi32(x, x), _mm256_packs_epi32(x, x));
+        y = _mm256_unpacklo_epi16(_mm256_packs_epi32(y, y), _mm256_packs_epi32(y, y));
+        __m256i xLow = _mm256_unpacklo_epi32(x, x), xHigh = _mm256_unpackhi_epi32(x, x);
+        __m256i yLow = _mm256_unpacklo_epi32(y, y), yHigh = _mm256_unpackhi_epi32(y, y);
+
+        __m256i low = Lerp(Lerp(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), xLow),
+                           Lerp(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero), xLow), yLow);
+        __m256i high = Lerp(Lerp(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), xHigh),
+                            Lerp(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero), xHigh), yHigh);
+        _mm256_storeu_si256((__m256i *)out, _mm256_packus_epi16(low, high));
+    }
+};
+#endif
+
+// Colors of the texels at texel coordinates x, y for the lanes set in mask,
+// point sampled or bilinear as the sampler says
+template <typename L>
+void SampleTexels(const TriangleSetup &s, typename L::Float x, typename L::Float y, int mask, Uint32 *colors)
+{
+    const int N = L::Count;
+
+    alignas(32) int texX[N];
+    alignas(32) int texY[N];
+    if (s.texture.sampler.filter != TextureFilter::Bilinear)
+    {
+        L::ToInt(x, texX);
+        L::ToInt(y, texY);
+        FetchTexels(s, texX, texY, mask, N, colors);
+        return;
+    }
+
+    // Top left texel of the 2x2 is half a texel up and left. The offset keeps
+    // coordinates positive so truncating floors them
+    typename L::Float bias = L::Set((float)(BILINEAR_OFFSET * 256 - 128));
+    L::ToInt(L::Add(L::Mul(x, L::Set(256.0f)), bias), texX);
+    L::ToInt(L::Add(L::Mul(y, L::Set(256.0f)), bias), texY);
+
+    alignas(32) Uint32 quad[4][N];
+    alignas(32) int weightX[N];
+    alignas(32) int weightY[N];
+    FetchQuads(s, texX, texY, mask, N, quad[0], quad[1], quad[2], quad[3], weightX, weightY);
+    L::Bilerp(quad[0], quad[1], quad[2], quad[3], weightX, weightY, colors);
+}
+
+// Draw pixels [x0, x1] of row y, returns how many of them the triangle covers
+template <typename L>
+int RasterizeRow(const RenderTarget &target, const TriangleSetup &s, int y, int x0, int x1, Uint32 *colors)
+{
+    const int N = L::Count;
+
+    alignas(32) int red[N];
+    alignas(32) int green[N];
+    alignas(32) int blue[N];
+
+    float py = (float)y + 0.5f;
+
+    // Row terms, evaluated the same way by every path
+    long long centerY = (long long)y * SUBPIXEL_STEPS + SUBPIXEL_STEPS / 2;
+    long long e0Row = s.fixB[0] * centerY + s.fixC[0];
+    long long e1Row = s.fixB[1] * centerY + s.fixC[1];
+    long long e2Row = s.fixB[2] * centerY + s.fixC[2];
+    typename L::Float zRow = L::Set(s.z.c + s.z.dy * py);
+    typename L::Float uRow = L::Set(s.u.c + s.u.dy * py);
+    typename L::Float vRow = L::Set(s.v.c + s.v.dy * py);
+    typename L::Float rRow = L::Set(s.r.c + s.r.dy * py);
+    typename L::Float gRow = L::Set(s.g.c + s.g.dy * py);
+    typename L::Float bRow = L::Set(s.b.c + s.b.dy * py);
+
+    Uint32 *colorRow = (target.ids ? target.ids : target.color) + y * target.width;
+    float *depthRow = target.depth + y * target.width;
+    int covered = 0;
+
+    // Shading is left to the resolve pass when writing triangle IDs
+    bool sample = s.texture.texels && !target.ids;
+    bool blend = s.smooth && !target.ids;
+
+    for (int x = x0; x <= x1; x += N)
+    {
+        int n = x1 - x + 1;
+        if (n > N) n = N;
+
+        typename L::Float px = L::Ramp((float)x + 0.5f);
+
+        // Coverage, exact integer edges so every path agrees. Inside when no
+        // edge value has its sign bit set
+        long long centerX = (long long)x * SUBPIXEL_STEPS + SUBPIXEL_STEPS / 2;
+        typename L::Int e0 = L::Ramp(e0Row + s.fixA[0] * centerX, s.fixA[0] * SUBPIXEL_STEPS);
+        typename L::Int e1 = L::Ramp(e1Row + s.fixA[1] * centerX, s.fixA[1] * SUBPIXEL_STEPS);
+        typename L::Int e2 = L::Ramp(e2Row + s.fixA[2] * centerX, s.fixA[2] * SUBPIXEL_STEPS);
+        typename L::Mask mask = L::And(L::FirstN(n), L::NotNegative(L::Or(e0, L::Or(e1, e2))));
+        if (!L::Bits(mask)) continue;
+        covered += __builtin_popcount(L::Bits(mask));
+
+        // Depth test
+        typename L::Float z = L::Add(zRow, L::Mul(L::Set(s.z.dx), px));
+        if (s.depthTest)
+        {
+            mask = L::And(mask, L::Less(z, L::Load(depthRow + x, n)));
+            if (!L::Bits(mask)) continue;
+        }
+
+        // Gouraud colors, linear in screen space
+        if (blend)
+        {
+            L::ToInt(L::Add(rRow, L::Mul(L::Set(s.r.dx), px)), red);
+            L::ToInt(L::Add(gRow, L::Mul(L::Set(s.g.dx), px)), green);
+            L::ToInt(L::Add(bRow, L::Mul(L::Set(s.b.dx), px)), blue);
+            BlendColors(red, green, blue, L::Bits(mask), N, colors);
+        }
+
+        // Perspective-correct UVs, then texel fetch
+        else if (sample)
+        {
+            typename L::Float u = L::Div(L::Add(uRow, L::Mul(L::Set(s.u.dx), px)), z);
+            typename L::Float v = L::Div(L::Add(vRow, L::Mul(L::Set(s.v.dx), px)), z);
+            SampleTexels<L>(s, L::Mul(u, L::Set(s.texWidth)), L::Mul(v, L::Set(s.texHeight)), L::Bits(mask), colors);
+        }
+
+        L::Store(colorRow + x, mask, colors, n);
+        if (s.depthTest || s.depthWrite) L::Store(depthRow + x, mask, z, n);
+    }
+
+    return covered;
+}
+
+// Fill pixels [x0, x1] of row y, all covered, with the flat color (or ID).
+// Only the depth test remains per pixel
+template <typename L>
+void FillRow(const RenderTarget &target, const TriangleSetup &s, int y, int x0, int x1, const Uint32 *colors)
+{
+    const int N = L::Count;
+
+    Uint32 *colorRow = (target.ids ? target.ids : target.color) + y * target.width;
+    float *depthRow = target.depth + y * target.width;
+    float py = (float)y + 0.5f;
+    typename L::Float zRow = L::Set(s.z.c + s.z.dy * py);
+
+    if (!s.depthTest)
+    {
+        for (int x = x0; x <= x1; x += N)
+        {
+            int n = x1 - x + 1 < N ? x1 - x + 1 : N;
+            L::Fill(colorRow + x, colors, n);
+            if (s.depthWrite)
+                L::Store(depthRow + x, L::FirstN(n), L::Add(zRow, L::Mul(L::Set(s.z.dx), L::Ramp((float)x + 0.5f))), n);
+        }
+        return;
+    }
+
+    for (int x = x0; x <= x1; x += N)
+    {
+        int n = x1 - x + 1;
+        if (n > N) n = N;
+
+        typename L::Float z = L::Add(zRow, L::Mul(L::Set(s.z.dx), L::Ramp((float)x + 0.5f)));
+        typename L::Mask mask = L::And(L::FirstN(n), L::Less(z, L::Load(depthRow + x, n)));
+        if (!L::Bits(mask)) continue;
+
+        L::Store(colorRow + x, mask, colors, n);
+        L::Store(depthRow + x, mask, z, n);
+    }
+}
+
+// Farthest depth of the HiZ blocks [bx0, bx1] x [by0, by1]
+inline float MaxBlockDepth(const RenderTarget &target, int bx0, int by0, int bx1, int by1)
+{
+    float farthest = -INFINITY;
+    for (int by = by0; by <= by1; by++)
+        for (int bx = bx0; bx <= bx1; bx++)
+        {
+            float d = target.hizBlocks[by * target.hizBlocksX + bx];
+            farthest = d > farthest ? d : farthest;
+        }
+    return farthest;
+}
+
+template <typename L>
+void RasterizeLanes(const RenderTarget &target, const TriangleSetup &s)
+{
+    const int N = L::Count;
+
+    // Flat color (or triangle ID) is the same for every lane, texels and
+    // blended colors overwrite it
+    alignas(32) Uint32 colors[N];
+    for (int i = 0; i < N; i++) colors[i] = target.ids ? s.id : s.color;
+
+    // Early rejection needs the depth test and a depth pyramid
+    bool hiz = s.depthTest && target.hizBlocks;
+
+    // Depth written without the test may be farther than what it covers, so
+    // the blocks it touches are raised instead to stay conservative
+    bool raise = s.depthWrite && !s.depthTest && target.hizBlocks;
+
+    // Nothing to sample per pixel, rows are filled as runs. Finding a run
+    // costs more than testing a few pixels, so narrow triangles skip it
+    bool flat = ((!s.texture.texels && !s.smooth) || target.ids) && s.maxX - s.minX >= FILL_MIN_WIDTH;
+
+    // Whole triangle behind what is already drawn
+    int tx0 = s.minX / HIZ_TILE, tx1 = s.maxX / HIZ_TILE;
+    int ty0 = s.minY / HIZ_TILE, ty1 = s.maxY / HIZ_TILE;
+    if (hiz)
+    {
+        bool visible = false;
+        for (int ty = ty0; ty <= ty1 && !visible; ty++)
+            for (int tx = tx0; tx <= tx1 && !visible; tx++)
+                visible = s.zMin < target.hizTiles[ty * target.hizTilesX + tx];
+        if (!visible) return;
+    }
+
+    // Walk the bounding box in 8x8 blocks
+    bool pyramidChanged = false;
+    for (int by = s.minY / HIZ_BLOCK; by <= s.maxY / HIZ_BLOCK; by++)
+    {
+        int y0 = by * HIZ_BLOCK > s.minY ? by * HIZ_BLOCK : s.minY;
+        int y1 = by * HIZ_BLOCK + HIZ_BLOCK - 1 < s.maxY ? by * HIZ_BLOCK + HIZ_BLOCK - 1 : s.maxY;
+
+        // Covered run of each row, shared by the blocks of this row
+        int runX0[HIZ_BLOCK], runX1[HIZ_BLOCK];
+        if (flat)
+            for (int y = y0; y <= y1; y++)
+                RowCoverage(s, y, runX0[y - y0], runX1[y - y0]);
+
+        for (int bx = s.minX / HIZ_BLOCK; bx <= s.maxX / HIZ_BLOCK; bx++)
+        {
+            int x0 = bx * HIZ_BLOCK > s.minX ? bx * HIZ_BLOCK : s.minX;
+            int x1 = bx * HIZ_BLOCK + HIZ_BLOCK - 1 < s.maxX ? bx * HIZ_BLOCK + HIZ_BLOCK - 1 : s.maxX;
+
+            // Closest the triangle gets inside this block, compared against
+            // the farthest depth already stored there
+            float *blockDepth = NULL;
+            float zMax = 0.0f;
+            if (hiz || raise)
+            {
+                blockDepth = &target.hizBlocks[by * target.hizBlocksX + bx];
+                float farX = (s.z.dx >= 0.0f ? x1 : x0) + 0.5f;
+                float farY = (s.z.dy >= 0.0f ? y1 : y0) + 0.5f;
+                zMax = s.z.c + s.z.dy * farY + s.z.dx * farX + s.zEpsilon;
+            }
+            if (hiz)
+            {
+                float nearX = (s.z.dx >= 0.0f ? x0 : x1) + 0.5f;
+                float nearY = (s.z.dy >= 0.0f ? y0 : y1) + 0.5f;
+                float zMin = s.z.c + s.z.dy * nearY + s.z.dx * nearX - s.zEpsilon;
+                if (zMin < s.zMin) zMin = s.zMin;
+                if (zMin >= *blockDepth) continue;
+            }
+
+            int covered = 0;
+            for (int y = y0; y <= y1; y++)
+            {
+                if (!flat)
+                {
+                    covered += RasterizeRow<L>(target, s, y, x0, x1, colors);
+                    continue;
+                }
+
+                int a = runX0[y - y0] > x0 ? runX0[y - y0] : x0;
+                int b = runX1[y - y0] < x1 ? runX1[y - y0] : x1;
+                if (a > b) continue;
+                FillRow<L>(target, s, y, a, b, colors);
+                covered += b - a + 1;
+            }
+
+            // A block the triangle covers completely now holds nothing farther
+            // than the triangle itself. Partly covered blocks keep their old,
+            // still conservative, value
+            if (hiz && covered == HIZ_BLOCK * HIZ_BLOCK && zMax < *blockDepth)
+            {
+                *blockDepth = zMax;
+                pyramidChanged = true;
+            }
+            if (raise && covered && zMax > *blockDepth)
+            {
+                *blockDepth = zMax;
+                pyramidChanged = true;
+            }
+        }
+    }
+
+    // Then the coarse level above the changed blocks
+    if (pyramidChanged)
+    {
+        const int blocksPerTile = HIZ_TILE / HIZ_BLOCK;
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                int bx0 = tx * blocksPerTile, by0 = ty * blocksPerTile;
+                int bx1 = bx0 + blocksPerTile - 1 < target.hizBlocksX - 1 ? bx0 + blocksPerTile - 1 : target.hizBlocksX - 1;
+                int by1 = by0 + blocksPerTile - 1 < target.hizBlocksY - 1 ? by0 + blocksPerTile - 1 : target.hizBlocksY - 1;
+                target.hizTiles[ty * target.hizTilesX + tx] = MaxBlockDepth(target, bx0, by0, bx1, by1);
+            }
+    }
+}
+
+} // namespace
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <vec2.hpp>
+#include <texuv.hpp>
+#include <texture.hpp>
+
+// Depth pyramid levels: farthest depth of each 8x8 block, and of each 64x64 tile
+#define HIZ_BLOCK 8
+#define HIZ_TILE 64
+
+// Vertices are snapped to 28.4 fixed point before rasterizing. Anything
+// farther than SUBPIXEL_LIMIT pixels from the origin can't be snapped
+#define SUBPIXEL_STEPS 16
+#define SUBPIXEL_LIMIT 67108864.0f
+
+// Triangles may reach this many pixels past each side of the target, the
+// rasterizer scissors them. Far below SUBPIXEL_LIMIT, and small enough that
+// most triangles keep 32-bit edges
+#define GUARD_BAND 512
+
+// Flat triangles at least this wide are filled one covered run per row
+#define FILL_MIN_WIDTH 16
+
+// Depth-tested lines are pulled this much (relative to 1/w) towards the
+// camera, so edges of the surface they lie on don't hide them
+#define LINE_DEPTH_BIAS 1e-3f
+
+// Bilinear texel coordinates are moved this many texels right and down
+// before flooring, so UVs down to -BILINEAR_OFFSET / size floor right
+#define BILINEAR_OFFSET 4096
+
+// Visibility buffer entry of pixels no triangle covers
+#define VISIBILITY_EMPTY 0xFFFFFFFFu
+
+// Pixel buffers the rasterizer draws into
+struct RenderTarget
+{
+    Uint32 *color = NULL;
+    float *depth = NULL;
+    int width = 0, height = 0;
+
+    // Visibility buffer. When set, triangles write their ID here instead of
+    // a color, and ResolveRow shades the pixels afterwards
+    Uint32 *ids = NULL;
+
+    // Depth pyramid kept up to date with depth, NULL disables early rejection
+    float *hizBlocks = NULL;
+    float *hizTiles = NULL;
+    int hizBlocksX = 0, hizBlocksY = 0;
+    int hizTilesX = 0;
+
+    // Only pixels inside [minX, maxX) x [minY, maxY) are written
+    int minX = 0, minY = 0;
+    int maxX = 0, maxY = 0;
+};
+
+// Screen-space triangle handed to the rasterizer
+struct RasterTriangle
+{
+    // Screen positions
+    Vec2 p[3];
+
+    // Perspective-divided UVs (u/w, v/w, 1/w), 1/w is also used as depth
+    TexUV t[3];
+
+    // Flat color, also used by base color textures
+    SDL_Color color = {0, 0, 0, SDL_ALPHA_OPAQUE};
+
+    // Corner colors blended over the triangle instead of color (Gouraud)
+    SDL_Color colors[3] = {color, color, color};
+    bool smooth = false;
+
+    // Texture to sample, NULL for flat triangles
+    const Texture *texture = NULL;
+
+    // Depth test and write, flat triangles are usually drawn in order without
+    bool depthTest = false;
+
+    // Write depth even without the test, so lines can be hidden behind
+    // triangles drawn in order
+    bool depthWrite = false;
+};
+
+// Screen-space line handed to the rasterizer, both end pixels are drawn
+struct RasterLine
+{
+    Vec2 p[2];
+
+    // 1/w at both ends, only used with the depth test
+    float z[2] = {0.0f, 0.0f};
+
+    Uint32 color = 0;
+
+    // Hide the line behind what is in the depth buffer (it never writes depth)
+    bool depthTest = false;
+};
+
+// Triangle after setup, ready for the inner loops
+struct TriangleSetup
+{
+    // Pixel bounding box (inclusive), clipped to the target when drawing
+    int minX, minY, maxX, maxY;
+
+    // Edge functions in 28.4 fixed point, evaluated at pixel centers
+    // E = A * (16 * x + 8) + B * (16 * y + 8) + C, inside when all are >= 0.
+    // C already holds the top-left rule bias
+    long long fixA[3], fixB[3], fixC[3];
+
+    // Edge values fit in 32 bits anywhere in the bounding box
+    bool narrowEdges;
+
+    // Same edges in pixels, E(x, y) = A * x + B * y + C, used to build the
+    // attribute planes
+    float edgeA[3], edgeB[3], edgeC[3];
+
+    // Attribute planes, value(x, y) = c + dx * x + dy * y
+    struct Plane
+    {
+        float c, dx, dy;
+    };
+    Plane z, u, v;
+
+    // Lower bound of depth over the triangle, and the rounding error allowed
+    // when bounding the z plane over a block
+    float zMin, zEpsilon;
+
+    // Depth test and write, or only the write
+    bool depthTest, depthWrite;
+
+    // Flat color, used when there is no texture to sample
+    Uint32 color;
+
+    // Color channel planes blended per pixel instead, 0.5 above the corner
+    // values so truncating rounds
+    bool smooth;
+    Plane r, g, b;
+
+    // Written to the visibility buffer, index of this setup for ResolveRow
+    Uint32 id;
+
+    // Texture sampled per pixel, resolved so a fetch is one indexed load.
+    // Texels are NULL for flat color
+    TextureView texture;
+    float texWidth, texHeight;
+};
+
+// Instruction set used by the rasterizer inner loops
+enum class RasterPath
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// Half-space (edge function) triangle rasterizer
+class Rasterizer
+{
+public:
+    // Picks the fastest path supported by the CPU
+    Rasterizer();
+
+    // Path used for drawing, can be changed to validate against another one
+    RasterPath path = RasterPath::Scalar;
+
+    // Draw triangle into target
+    void DrawTriangle(const RenderTarget &target, const RasterTriangle &tri);
+
+    // Same as DrawTriangle, split so one setup can be drawn into several targets.
+    // SetupTriangle returns false if the triangle covers no pixel of the target
+    bool SetupTriangle(const RenderTarget &target, const RasterTriangle &tri, TriangleSetup &s);
+    void DrawSetup(const RenderTarget &target, const TriangleSetup &s);
+
+    // Draw line into target. Pixels depend only on the line, so drawing it
+    // into each tile of the screen gives the same result as one full target
+    void DrawLine(const RenderTarget &target, const RasterLine &line);
+
+    // Shade row y of a visibility buffer, pixels [minX, maxX) of target.
+    // IDs index setups
+    void ResolveRow(const RenderTarget &target, const TriangleSetup *setups, int y);
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+#include <mesh.hpp>
+
+// Quadric error metric simplification (Garland and Heckbert). Edges are
+// collapsed cheapest first onto one of their ends, so every level keeps a
+// subset of the mesh's positions and shares its UVs and vertex normals.
+// One level is taken each time the triangle count gets down to the next of
+// targets (decreasing). Stops early, with fewer levels, when no edge can be
+// collapsed anymore
+std::vector<MeshLOD> SimplifyMesh(const Mesh &mesh, const std::vector<int> &targets);
@@ -8,6 +8,7 @@
 
 // Other structs
 #include <camera.hpp>
+#include <color.hpp>
 #include <hsl.hpp>
 #include <mat4.hpp>
 #include <mesh.hpp>
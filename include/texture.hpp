@@ -3,46 +3,180 @@
 #include <SDL2/SDL.h>
 #include <bits/stdc++.h>
 
-class Texture
+// What a sampler does with coordinates outside the image
+enum class TextureWrap
+{
+    // Tile the image
+    Repeat,
+
+    // Stretch the edge texels
+    Clamp
+};
+
+// How a sampler turns a coordinate into a color
+enum class TextureFilter
+{
+    // Texel the coordinate falls in
+    Nearest,
+
+    // Blend of the 2x2 texels around the coordinate
+    Bilinear
+};
+
+// Order of the texels of a level in memory, picked when loading. Linear
+// fetches fastest here, tests/texture_layouts.cpp compares them
+enum class TextureLayout
+{
+    // Row after row
+    Linear,
+
+    // 4x4 tiles row after row, texels of a tile row after row. Levels
+    // smaller than a tile stay linear
+    Tiled,
+
+    // Z-order, bits of x and y interleaved. The longer side's extra high bits
+    // go on top
+    Morton
+};
+
+// Sampling state, kept apart from the image so one image can be sampled
+// several ways
+struct Sampler
+{
+    TextureWrap wrap = TextureWrap::Repeat;
+    TextureFilter filter = TextureFilter::Nearest;
+
+    // Sample minified triangles from a smaller mip level
+    bool mipmaps = true;
+};
+
+// One level of a mip chain. Texels are in the framebuffer format, opaque.
+// width x height are powers of two, images of other sizes are stretched to
+// them at load, so masking with widthMask and heightMask wraps any
+// coordinate, negative ones too, without a branch. uScale x vScale texels
+// span the UV range 0 to 1
+struct TextureLevel
+{
+    const Uint32 *texels = NULL;
+    int width = 0, height = 0;
+    int widthMask = 0, heightMask = 0;
+    int rowShift = 0;
+    float uScale = 0.0f, vScale = 0.0f;
+
+    // Texel order, and log2 of the shorter side for Morton
+    TextureLayout layout = TextureLayout::Linear;
+    int squareShift = 0;
+};
+
+// Low 16 bits of v moved to the even bits
+inline Uint32 MortonSpread(Uint32 v)
+{
+    v &= 0xFFFF;
+    v = (v | v << 8) & 0x00FF00FF;
+    v = (v | v << 4) & 0x0F0F0F0F;
+    v = (v | v << 2) & 0x33333333;
+    v = (v | v << 1) & 0x55555555;
+    return v;
+}
+
+// Index in level.texels of texel x, y, already wrapped or clamped into the
+// level. Templated so loops over many texels pick the layout once
+template <TextureLayout layout>
+inline int TexelIndex(const TextureLevel &level, int x, int y)
+{
+    if (layout == TextureLayout::Tiled)
+        return (y >> 2) << (level.rowShift + 2) | (x >> 2) << 4 | (y & 3) << 2 | (x & 3);
+    if (layout == TextureLayout::Morton)
+    {
+        int low = (1 << level.squareShift) - 1;
+        return (int)(MortonSpread(x & low) | MortonSpread(y & low) << 1) | ((x | y) >> level.squareShift) << (2 * level.squareShift);
+    }
+    return y << level.rowShift | x;
+}
+
+inline int TexelIndex(const TextureLevel &level, int x, int y)
+{
+    switch (level.layout)
+    {
+        case TextureLayout::Tiled: return TexelIndex<TextureLayout::Tiled>(level, x, y);
+        case TextureLayout::Morton: return TexelIndex<TextureLayout::Morton>(level, x, y);
+        default: return TexelIndex<TextureLayout::Linear>(level, x, y);
+    }
+}
+
+// Texels of every mip level, converted once at load. Level 0 is the image
+// stretched to powers of two, each next one half its size down to 1 x 1.
+// width x height is the size of the file. Never changed after loading
+struct TextureImage
+{
+    std::vector<Uint32> texels;
+    std::vector<TextureLevel> levels;
+    int width = 0, height = 0;
+    TextureLayout layout = TextureLayout::Linear;
+};
+
+// Read-only view of one level of a texture and its sampler, resolved for the
+// rasterizer. Valid while the texture it came from is alive
+struct TextureView : TextureLevel
+{
+    Sampler sampler;
+};
+
+// Images loaded from files, shared by path. Held weakly, an image goes away
+// with the last texture using it
+class TextureRegistry
 {
 public:
-    // Constructors and destructor
-    Texture();
-    ~Texture();
+    // Registry Texture::init loads through
+    static TextureRegistry &Shared();
 
-    // Initialize texture from image
-    bool init(std::string filePath);
+    // Image of filePath in layout, loaded now if no texture holds it. NULL
+    // on failure
+    std::shared_ptr<const TextureImage> Load(const std::string &filePath, TextureLayout layout = TextureLayout::Linear);
 
-    // Initialize texture with base color
-    bool init(SDL_Color color);
+    // Images currently held by some texture
+    int Count();
 
-    // Copy-and-Swap idiom by GManNickG
-    // https://stackoverflow.com/questions/3279543/what-is-the-copy-and-swap-idiom
-    void swap(Texture& first, Texture& second);
+private:
+    std::map<std::pair<std::string, TextureLayout>, std::weak_ptr<const TextureImage>> images;
+};
 
-    Texture& operator=(Texture other);
+// Handle to a shared image, or a base color. Copies are cheap and share the
+// image, which is freed with the last of them
+class Texture
+{
+public:
+    // Initialize texture from image, its texels stored in layout
+    bool init(std::string filePath, TextureLayout layout = TextureLayout::Linear);
 
-    // copy-constructor
-    // Texture(const Texture& other);
+    // Initialize texture with base color
+    bool init(SDL_Color color);
 
     // If texture has been loaded
-    bool loaded;
+    bool loaded = false;
 
     // Whether this texture is only a base color (not loaded from image file)
-    bool isBaseColor;
+    bool isBaseColor = false;
 
-    // Surface size
+    // Image size
     int width = 0, height = 0;
 
     // Base color, in case texture was not loaded from image file
     SDL_Color baseColor = {0, 0, 0, SDL_ALPHA_OPAQUE};
 
+    // How the rasterizer samples it
+    Sampler sampler;
+
+    // Image loaded from file, NULL for base colors
+    std::shared_ptr<const TextureImage> image;
+
     // Get color at given coordinate
-    SDL_Color GetColorAt(int x, int y);
-private:
-    // Get pixel data
-    Uint32 GetPixel(int x, int y);
+    SDL_Color GetColorAt(int x, int y) const;
+
+    // Mip levels, 0 for textures without texels
+    int LevelCount() const;
 
-    // Surface loaded from file
-    SDL_Surface *surface;
-};
\ No newline at end of file
+    // View of mip level (clamped to the chain) for the rasterizer. Texels
+    // are NULL for textures without them
+    TextureView View(int level = 0) const;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Persistent worker threads that run a job over a range of indices
+class ThreadPool
+{
+public:
+    ThreadPool();
+    ~ThreadPool();
+
+    // Number of threads running jobs, including the calling thread
+    void SetThreadCount(int count);
+    int GetThreadCount() { return threadCount; }
+
+    // Run job(i) for every i in [0, count), returns once all of them are done.
+    // Indices are handed out in increasing order, each to exactly one thread
+    void ParallelFor(int count, std::function<void(int)> job);
+
+private:
+    // Worker side
+    void WorkerLoop(unsigned int seen);
+    void RunJobs();
+
+    // Stop and join all workers
+    void StopWorkers();
+
+    int threadCount = 1;
+    std::vector<std::thread> workers;
+
+    // Current job
+    std::function<void(int)> job;
+    int jobCount = 0;
+    std::atomic<int> nextIndex;
+
+    // Synchronization
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    unsigned int generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+};
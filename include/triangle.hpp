@@ -15,4 +15,8 @@ struct Triangle
 
     // Color, in case of no texture
     SDL_Color color = {255, 255, 255, SDL_ALPHA_OPAQUE};
+
+    // Color of each vertex, blended over the triangle instead when smooth
+    SDL_Color vertexColors[3] = {color, color, color};
+    bool smooth = false;
 };
\ No newline at end of file
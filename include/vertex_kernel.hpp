@@ -0,0 +1,272 @@
+#pragma once
+
+// Vertex transform loops, shared by every instruction set.
+// Like raster_kernel.hpp, this header is compiled once per path
+// (vertex_stream.cpp for scalar and SSE2, vertex_stream_avx2.cpp with -mavx2),
+// so everything below the declarations lives in an anonymous namespace.
+// Every path does the same operations in the same order as Mat4 * Vec3,
+// results are identical to the scalar code.
+
+#include <cmath>
+
+#include <vertex_stream.hpp>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Entry points of each path, vertices [begin, end)
+void TransformPositionsScalar(const Mat4 &m, const Vec3 *in, Vec3 scale, int begin, int end, VertexStream &out);
+void TransformPositionsSSE2(const Mat4 &m, const Vec3 *in, Vec3 scale, int begin, int end, VertexStream &out);
+void TransformPositionsAVX2(const Mat4 &m, const Vec3 *in, Vec3 scale, int begin, int end, VertexStream &out);
+
+void TransformStreamScalar(const Mat4 &m, const VertexStream &in, int begin, int end, VertexStream &out);
+void TransformStreamSSE2(const Mat4 &m, const VertexStream &in, int begin, int end, VertexStream &out);
+void TransformStreamAVX2(const Mat4 &m, const VertexStream &in, int begin, int end, VertexStream &out);
+
+void ProjectStreamScalar(const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, float halfWidth, float halfHeight, int begin, int end, VertexStream &out, Uint8 *codes);
+void ProjectStreamSSE2(const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, float halfWidth, float halfHeight, int begin, int end, VertexStream &out, Uint8 *codes);
+void ProjectStreamAVX2(const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, float halfWidth, float halfHeight, int begin, int end, VertexStream &out, Uint8 *codes);
+
+void LightStreamScalar(const VertexStream &normals, const float *lights, int lightCount, float ambient, int begin, int end, float *out);
+void LightStreamSSE2(const VertexStream &normals, const float *lights, int lightCount, float ambient, int begin, int end, float *out);
+void LightStreamAVX2(const VertexStream &normals, const float *lights, int lightCount, float ambient, int begin, int end, float *out);
+
+namespace
+{
+
+// One vertex at a time, reference for the SIMD paths
+struct VertexLanesScalar
+{
+    static const int Count = 1;
+    typedef float Float;
+
+    static Float Set(float f) { return f; }
+    static Float Add(Float a, Float b) { return a + b; }
+    static Float Mul(Float a, Float b) { return a * b; }
+    static Float Div(Float a, Float b) { return a / b; }
+    static Float Max(Float a, Float b) { return a > b ? a : b; }
+    static Float Sqrt(Float a) { return std::sqrt(a); }
+
+    static int LessBits(Float a, Float b) { return a < b ? 1 : 0; }
+
+    static Float Load(const float *p) { return p[0]; }
+    static void Store(float *p, Float f) { p[0] = f; }
+
+    // Split Vec3s into x, y and z
+    static void LoadPositions(const Vec3 *p, Float &x, Float &y, Float &z)
+    {
+        x = p[0].x; y = p[0].y; z = p[0].z;
+    }
+};
+
+#if defined(__SSE2__)
+// Four vertices at a time
+struct VertexLanesSSE2
+{
+    static const int Count = 4;
+    typedef __m128 Float;
+
+    static Float Set(float f) { return _mm_set1_ps(f); }
+    static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+    static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+    static Float Max(Float a, Float b) { return _mm_max_ps(a, b); }
+    static Float Sqrt(Float a) { return _mm_sqrt_ps(a); }
+
+    // Lane i of a < b in bit i
+    static int LessBits(Float a, Float b) { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+
+    static Float Load(const float *p) { return _mm_loadu_ps(p); }
+    static void Store(float *p, Float f) { _mm_storeu_ps(p, f); }
+
+    // A Vec3 is four floats, one transpose turns four of them into x, y, z (and w)
+    static void LoadPositions(const Vec3 *p, Float &x, Float &y, Float &z)
+    {
+        __m128 r0 = _mm_loadu_ps(&p[0].x);
+        __m128 r1 = _mm_loadu_ps(&p[1].x);
+        __m128 r2 = _mm_loadu_ps(&p[2].x);
+        __m128 r3 = _mm_loadu_ps(&p[3].x);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        x = r0; y = r1; z = r2;
+    }
+};
+#endif
+
+#if defined(__AVX2__)
+// Eight vertices at a time
+struct VertexLanesAVX2
+{
+    static const int Count = 8;
+    typedef __m256 Float;
+
+    static Float Set(float f) { return _mm256_set1_ps(f); }
+    static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+    static Float Max(Float a, Float b) { return _mm256_max_ps(a, b); }
+    static Float Sqrt(Float a) { return _mm256_sqrt_ps(a); }
+
+    static int LessBits(Float a, Float b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+
+    static Float Load(const float *p) { return _mm256_loadu_ps(p); }
+    static void Store(float *p, Float f) { _mm256_storeu_ps(p, f); }
+
+    // Two 4x4 transposes, low half from the first four Vec3s
+    static void LoadPositions(const Vec3 *p, Float &x, Float &y, Float &z)
+    {
+        __m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&p[0].x)), _mm_loadu_ps(&p[4].x), 1);
+        __m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&p[1].x)), _mm_loadu_ps(&p[5].x), 1);
+        __m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&p[2].x)), _mm_loadu_ps(&p[6].x), 1);
+        __m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&p[3].x)), _mm_loadu_ps(&p[7].x), 1);
+
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+        __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+        __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+        x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    }
+};
+#endif
+
+// x, y and z terms of column c of m, summed in the same order as Mat4 * Vec3
+template <typename L>
+typename L::Float Column(const Mat4 &m, int c, typename L::Float x, typename L::Float y, typename L::Float z)
+{
+    typename L::Float r = L::Mul(x, L::Set(m.m[0][c]));
+    r = L::Add(r, L::Mul(y, L::Set(m.m[1][c])));
+    r = L::Add(r, L::Mul(z, L::Set(m.m[2][c])));
+    return r;
+}
+
+// out = m * (in * scale), whole groups of L::Count vertices only. Returns the
+// first vertex left over. Like Vec3 * Vec3, the scaled position has w = 1
+template <typename L>
+int TransformPositionsLanes(const Mat4 &m, const Vec3 *in, Vec3 scale, int begin, int end, VertexStream &out)
+{
+    const int N = L::Count;
+
+    int i = begin;
+    for (; i + N <= end; i += N)
+    {
+        typename L::Float x, y, z;
+        L::LoadPositions(in + i, x, y, z);
+        x = L::Mul(x, L::Set(scale.x));
+        y = L::Mul(y, L::Set(scale.y));
+        z = L::Mul(z, L::Set(scale.z));
+
+        L::Store(&out.x[i], L::Add(Column<L>(m, 0, x, y, z), L::Set(m.m[3][0])));
+        L::Store(&out.y[i], L::Add(Column<L>(m, 1, x, y, z), L::Set(m.m[3][1])));
+        L::Store(&out.z[i], L::Add(Column<L>(m, 2, x, y, z), L::Set(m.m[3][2])));
+        L::Store(&out.w[i], L::Add(Column<L>(m, 3, x, y, z), L::Set(m.m[3][3])));
+    }
+
+    return i;
+}
+
+// out = m * in, whole groups only. Returns the first vertex left over
+template <typename L>
+int TransformStreamLanes(const Mat4 &m, const VertexStream &in, int begin, int end, VertexStream &out)
+{
+    const int N = L::Count;
+
+    int i = begin;
+    for (; i + N <= end; i += N)
+    {
+        typename L::Float x = L::Load(&in.x[i]);
+        typename L::Float y = L::Load(&in.y[i]);
+        typename L::Float z = L::Load(&in.z[i]);
+        typename L::Float w = L::Load(&in.w[i]);
+
+        L::Store(&out.x[i], L::Add(Column<L>(m, 0, x, y, z), L::Set(m.m[3][0])));
+        L::Store(&out.y[i], L::Add(Column<L>(m, 1, x, y, z), L::Set(m.m[3][1])));
+        L::Store(&out.z[i], L::Add(Column<L>(m, 2, x, y, z), L::Set(m.m[3][2])));
+        L::Store(&out.w[i], L::Add(Column<L>(m, 3, x, y, z), L::Mul(w, L::Set(m.m[3][3]))));
+    }
+
+    return i;
+}
+
+// Project with m, divide by w and map to the screen. out holds screen x and y,
+// z / w and the clip space w, codes the outcodes against planes. Whole groups
+// only, returns the first vertex left over
+template <typename L>
+int ProjectStreamLanes(const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, float halfWidth, float halfHeight, int begin, int end, VertexStream &out, Uint8 *codes)
+{
+    const int N = L::Count;
+
+    int i = begin;
+    for (; i + N <= end; i += N)
+    {
+        typename L::Float x = L::Load(&in.x[i]);
+        typename L::Float y = L::Load(&in.y[i]);
+        typename L::Float z = L::Load(&in.z[i]);
+        typename L::Float w = L::Load(&in.w[i]);
+
+        typename L::Float cx = L::Add(Column<L>(m, 0, x, y, z), L::Set(m.m[3][0]));
+        typename L::Float cy = L::Add(Column<L>(m, 1, x, y, z), L::Set(m.m[3][1]));
+        typename L::Float cz = L::Add(Column<L>(m, 2, x, y, z), L::Set(m.m[3][2]));
+        typename L::Float cw = L::Add(Column<L>(m, 3, x, y, z), L::Mul(w, L::Set(m.m[3][3])));
+
+        // (p / w + 1) * half size, z gets + 0 like the Vec3 offset
+        L::Store(&out.x[i], L::Mul(L::Add(L::Div(cx, cw), L::Set(1.0f)), L::Set(halfWidth)));
+        L::Store(&out.y[i], L::Mul(L::Add(L::Div(cy, cw), L::Set(1.0f)), L::Set(halfHeight)));
+        L::Store(&out.z[i], L::Add(L::Div(cz, cw), L::Set(0.0f)));
+        L::Store(&out.w[i], cw);
+
+        // Bit k of each vertex set when outside plane k
+        int outside[6];
+        for (int k = 0; k < 6; k++)
+        {
+            const float *p = planes.plane[k];
+            typename L::Float xy = L::Add(L::Mul(cx, L::Set(p[0])), L::Mul(cy, L::Set(p[1])));
+            typename L::Float zw = L::Add(L::Mul(cz, L::Set(p[2])), L::Mul(cw, L::Set(p[3])));
+            outside[k] = L::LessBits(L::Add(xy, zw), L::Set(0.0f));
+        }
+        for (int lane = 0; lane < N; lane++)
+        {
+            int code = 0;
+            for (int k = 0; k < 6; k++)
+                code |= ((outside[k] >> lane) & 1) << k;
+            codes[i + lane] = (Uint8)code;
+        }
+    }
+
+    return i;
+}
+
+// Light falling on each normal, see LightStream. Whole groups only, returns
+// the first normal left over
+template <typename L>
+int LightStreamLanes(const VertexStream &normals, const float *lights, int lightCount, float ambient, int begin, int end, float *out)
+{
+    const int N = L::Count;
+
+    int i = begin;
+    for (; i + N <= end; i += N)
+    {
+        typename L::Float x = L::Load(&normals.x[i]);
+        typename L::Float y = L::Load(&normals.y[i]);
+        typename L::Float z = L::Load(&normals.z[i]);
+
+        // Normals come in any length, the cosines are divided by it
+        typename L::Float length2 = L::Add(L::Add(L::Mul(x, x), L::Mul(y, y)), L::Mul(z, z));
+        typename L::Float inverseLength = L::Div(L::Set(1.0f), L::Sqrt(length2));
+
+        typename L::Float light = L::Set(0.0f);
+        for (int l = 0; l < lightCount; l++)
+        {
+            const float *d = &lights[4 * l];
+            typename L::Float cosine = L::Add(L::Add(L::Mul(x, L::Set(d[0])), L::Mul(y, L::Set(d[1]))), L::Mul(z, L::Set(d[2])));
+            cosine = L::Mul(cosine, inverseLength);
+            light = L::Add(light, L::Mul(L::Max(cosine, L::Set(0.0f)), L::Set(d[3])));
+        }
+        L::Store(&out[i], L::Max(light, L::Set(ambient)));
+    }
+
+    return i;
+}
+
+} // namespace
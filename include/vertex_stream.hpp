@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include <vec3.hpp>
+#include <mat4.hpp>
+#include <rasterizer.hpp>
+#include <clipper.hpp>
+
+// Vertex positions as structure of arrays, one array per component
+struct VertexStream
+{
+    std::vector<float> x, y, z, w;
+
+    // Number of vertices
+    int Size() const { return (int)x.size(); }
+    void Resize(int count);
+
+    // Vertex i as a Vec3
+    Vec3 Get(int i) const { return Vec3(x[i], y[i], z[i], w[i]); }
+};
+
+// Mat4 * Vec3 over whole vertex arrays, several vertices per instruction
+// on the SIMD paths. Every path gives the same result as Mat4 * Vec3
+
+// out = m * (positions[i] * scale) for count positions
+void TransformPositions(RasterPath path, const Mat4 &m, const Vec3 *positions, Vec3 scale, int count, VertexStream &out);
+
+// out = m * in
+void TransformStream(RasterPath path, const Mat4 &m, const VertexStream &in, VertexStream &out);
+
+// Project in with m, divide by w and map to a width x height screen in the
+// same pass. out holds screen x and y, z / w and the clip space w, codes the
+// outcode of each vertex against planes
+void ProjectStream(RasterPath path, const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, int width, int height, VertexStream &out, std::vector<Uint8> &codes);
+
+// Light falling on faces with normals (any length, w unused): the sum over
+// lights of brightness times the cosine to the light, counted from 0, and
+// never under ambient. lights holds four floats per light, the unit
+// direction towards it and its brightness
+void LightStream(RasterPath path, const VertexStream &normals, const float *lights, int lightCount, float ambient, std::vector<float> &out);
@@ -0,0 +1,273 @@
+#include <algorithm>
+
+#include <bvh.hpp>
+
+// Surface area of a box, how likely a query is to visit it
+static float Area(Vec3 min, Vec3 max)
+{
+    Vec3 d = max - min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static bool Same(Vec3 a, Vec3 b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static void Grow(Vec3 &min, Vec3 &max, Vec3 boxMin, Vec3 boxMax)
+{
+    min = {std::min(min.x, boxMin.x), std::min(min.y, boxMin.y), std::min(min.z, boxMin.z)};
+    max = {std::max(max.x, boxMax.x), std::max(max.y, boxMax.y), std::max(max.z, boxMax.z)};
+}
+
+// World box around the mesh's model box
+static void MeshBox(Mesh &mesh, Vec3 &min, Vec3 &max)
+{
+    Mat4 matWorld = mesh.WorldMatrix();
+    for (int i = 0; i < 8; i++)
+    {
+        Vec3 corner = {
+            i & 1 ? mesh.boundsMax.x : mesh.boundsMin.x,
+            i & 2 ? mesh.boundsMax.y : mesh.boundsMin.y,
+            i & 4 ? mesh.boundsMax.z : mesh.boundsMin.z
+        };
+        Vec3 p = matWorld * (corner * mesh.size);
+
+        if (i == 0)
+            min = max = p;
+        else
+            Grow(min, max, p, p);
+    }
+}
+
+void BVH::Update(std::vector<Mesh> &meshes)
+{
+    if (meshes.size() != entries.size())
+    {
+        Rebuild(meshes);
+        return;
+    }
+
+    for (int i = 0; i < (int)meshes.size(); i++)
+    {
+        Mesh &mesh = meshes[i];
+        Entry &e = entries[i];
+        if (Same(e.position, mesh.position) && Same(e.rotation, mesh.rotation) && Same(e.size, mesh.size) &&
+            Same(e.boundsMin, mesh.boundsMin) && Same(e.boundsMax, mesh.boundsMax))
+            continue;
+
+        e.position = mesh.position;
+        e.rotation = mesh.rotation;
+        e.size = mesh.size;
+        e.boundsMin = mesh.boundsMin;
+        e.boundsMax = mesh.boundsMax;
+        MeshBox(mesh, e.min, e.max);
+        Refit(e.leaf);
+    }
+
+    // Refit boxes stretch as meshes drift apart, start over once queries
+    // would visit twice the area of a fresh tree
+    if (cost > 2.0f * builtCost)
+        Rebuild(meshes);
+}
+
+void BVH::Rebuild(std::vector<Mesh> &meshes)
+{
+    int count = (int)meshes.size();
+    entries.resize(count);
+    items.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        Mesh &mesh = meshes[i];
+        Entry &e = entries[i];
+        e.position = mesh.position;
+        e.rotation = mesh.rotation;
+        e.size = mesh.size;
+        e.boundsMin = mesh.boundsMin;
+        e.boundsMax = mesh.boundsMax;
+        MeshBox(mesh, e.min, e.max);
+        items[i] = i;
+    }
+
+    nodes.clear();
+    cost = 0.0f;
+    if (count > 0)
+    {
+        nodes.reserve(2 * count);
+        nodes.push_back(Node());
+        Build(0, 0, count);
+    }
+    builtCost = cost;
+}
+
+void BVH::Build(int node, int first, int count)
+{
+    // Bounds of the meshes and of their centers
+    Vec3 min = entries[items[first]].min, max = entries[items[first]].max;
+    Vec3 centerMin = (min + max) * 0.5f, centerMax = centerMin;
+    for (int i = first; i < first + count; i++)
+    {
+        Entry &e = entries[items[i]];
+        Vec3 center = (e.min + e.max) * 0.5f;
+        Grow(min, max, e.min, e.max);
+        Grow(centerMin, centerMax, center, center);
+    }
+    nodes[node].min = min;
+    nodes[node].max = max;
+    cost += Area(min, max);
+
+    if (count <= LEAF_SIZE)
+    {
+        nodes[node].first = first;
+        nodes[node].count = count;
+        for (int i = first; i < first + count; i++)
+            entries[items[i]].leaf = node;
+        return;
+    }
+
+    // Split at the median center along the widest axis
+    Vec3 extent = centerMax - centerMin;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    auto key = [&](int item)
+    {
+        Entry &e = entries[item];
+        return axis == 0 ? e.min.x + e.max.x : (axis == 1 ? e.min.y + e.max.y : e.min.z + e.max.z);
+    };
+    int half = count / 2;
+    std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+        [&](int a, int b) { return key(a) < key(b); });
+
+    int children = (int)nodes.size();
+    nodes.push_back(Node());
+    nodes.push_back(Node());
+    nodes[children].parent = node;
+    nodes[children + 1].parent = node;
+    nodes[node].first = children;
+    nodes[node].count = 0;
+
+    Build(children, first, half);
+    Build(children + 1, first + half, count - half);
+}
+
+void BVH::FitNode(int node)
+{
+    Node &n = nodes[node];
+    cost -= Area(n.min, n.max);
+
+    if (n.count > 0)
+    {
+        n.min = entries[items[n.first]].min;
+        n.max = entries[items[n.first]].max;
+        for (int i = n.first + 1; i < n.first + n.count; i++)
+            Grow(n.min, n.max, entries[items[i]].min, entries[items[i]].max);
+    }
+    else
+    {
+        n.min = nodes[n.first].min;
+        n.max = nodes[n.first].max;
+        Grow(n.min, n.max, nodes[n.first + 1].min, nodes[n.first + 1].max);
+    }
+
+    cost += Area(n.min, n.max);
+}
+
+void BVH::Refit(int node)
+{
+    // Leaf to root
+    for (; node >= 0; node = nodes[node].parent)
+        FitNode(node);
+}
+
+template <typename Overlaps>
+void BVH::Query(Overlaps overlaps, std::vector<int> &out)
+{
+    out.clear();
+    if (nodes.empty()) return;
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        Node &n = nodes[stack[--top]];
+        if (!overlaps(n.min, n.max)) continue;
+
+        if (n.count > 0)
+        {
+            for (int i = n.first; i < n.first + n.count; i++)
+                if (overlaps(entries[items[i]].min, entries[items[i]].max))
+                    out.push_back(items[i]);
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first + 1;
+        }
+    }
+}
+
+void BVH::QueryBox(Vec3 min, Vec3 max, std::vector<int> &out)
+{
+    Query([&](Vec3 &boxMin, Vec3 &boxMax)
+    {
+        return boxMin.x <= max.x && boxMax.x >= min.x &&
+               boxMin.y <= max.y && boxMax.y >= min.y &&
+               boxMin.z <= max.z && boxMax.z >= min.z;
+    }, out);
+}
+
+void BVH::QueryRadius(Vec3 center, float radius, std::vector<int> &out)
+{
+    Query([&](Vec3 &boxMin, Vec3 &boxMax)
+    {
+        // Closest point of the box to the center
+        Vec3 closest = Vec3(center.x, center.y, center.z).clamp(boxMin, boxMax);
+        Vec3 d = closest - center;
+        return d.dot(d) <= radius * radius;
+    }, out);
+}
+
+void BVH::QueryFrustum(Frustum &frustum, std::vector<int> &out)
+{
+    Query([&](Vec3 &boxMin, Vec3 &boxMax)
+    {
+        return frustum.TestBox(boxMin, boxMax) != FrustumTest::Outside;
+    }, out);
+}
+
+void BVH::CullFrustum(Frustum &frustum, std::vector<int> &out, std::vector<bool> &inside)
+{
+    out.clear();
+    inside.resize(entries.size());
+    if (nodes.empty()) return;
+
+    // Nodes paired with whether they are already known to be inside
+    std::pair<int, bool> stack[64];
+    int top = 0;
+    stack[top++] = {0, false};
+    while (top > 0)
+    {
+        auto [index, known] = stack[--top];
+        Node &n = nodes[index];
+
+        FrustumTest test = known ? FrustumTest::Inside : frustum.TestBox(n.min, n.max);
+        if (test == FrustumTest::Outside) continue;
+
+        if (n.count == 0)
+        {
+            stack[top++] = {n.first, test == FrustumTest::Inside};
+            stack[top++] = {n.first + 1, test == FrustumTest::Inside};
+            continue;
+        }
+
+        for (int i = n.first; i < n.first + n.count; i++)
+        {
+            int item = items[i];
+            FrustumTest itemTest = test == FrustumTest::Inside ? test : frustum.TestBox(entries[item].min, entries[item].max);
+            if (itemTest == FrustumTest::Outside) continue;
+
+            out.push_back(item);
+            inside[item] = itemTest == FrustumTest::Inside;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include <clipper.hpp>
+#include <rasterizer.hpp>
+
+ClipPlanes ClipPlanes::FromProjection(const Mat4 &proj, float near, float far, int width, int height)
+{
+    const float (*m)[4] = proj.m;
+
+    // Visible points get clip w of this sign, the engine's projection makes it
+    // negative. Multiplying by it keeps inside positive
+    float sign = near * m[2][3] + m[3][3] < 0.0f ? -1.0f : 1.0f;
+
+    // Guard band in NDC, one pixel is 2 / width
+    float bandX = 1.0f + 2.0f * GUARD_BAND / width;
+    float bandY = 1.0f + 2.0f * GUARD_BAND / height;
+
+    ClipPlanes p = {{
+        { sign, 0.0f, 0.0f, sign * bandX},      // band * w + x
+        {-sign, 0.0f, 0.0f, sign * bandX},      // band * w - x
+        {0.0f,  sign, 0.0f, sign * bandY},
+        {0.0f, -sign, 0.0f, sign * bandY},
+    }};
+
+    // View z from clip z and w: solve a * (m22 * z + m32) + b * (m23 * z + m33)
+    // for z - near and far - z
+    float det = m[2][2] * m[3][3] - m[3][2] * m[2][3];
+    p.plane[4][2] = (m[3][3] + near * m[2][3]) / det;
+    p.plane[4][3] = (-near * m[2][2] - m[3][2]) / det;
+    p.plane[5][2] = (-m[3][3] - far * m[2][3]) / det;
+    p.plane[5][3] = (far * m[2][2] + m[3][2]) / det;
+    return p;
+}
+
+static float Distance(const float *plane, const ClipVertex &v)
+{
+    return (v.x * plane[0] + v.y * plane[1]) + (v.z * plane[2] + v.w * plane[3]);
+}
+
+// Point of segment a -> b at t
+static ClipVertex Lerp(const ClipVertex &a, const ClipVertex &b, float t)
+{
+    ClipVertex v;
+    v.x = a.x + (b.x - a.x) * t;
+    v.y = a.y + (b.y - a.y) * t;
+    v.z = a.z + (b.z - a.z) * t;
+    v.w = a.w + (b.w - a.w) * t;
+    v.t.u = a.t.u + (b.t.u - a.t.u) * t;
+    v.t.v = a.t.v + (b.t.v - a.t.v) * t;
+    v.t.w = a.t.w + (b.t.w - a.t.w) * t;
+    v.r = a.r + (b.r - a.r) * t;
+    v.g = a.g + (b.g - a.g) * t;
+    v.b = a.b + (b.b - a.b) * t;
+    return v;
+}
+
+int ClipPolygon(const ClipPlanes &planes, int mask, const ClipVertex *in, int count, ClipVertex *out)
+{
+    ClipVertex buffers[2][CLIP_MAX_VERTICES];
+    const ClipVertex *from = in;
+    int which = 0;
+
+    for (int i = 0; i < 6 && count >= 3; i++)
+    {
+        if (!(mask & (1 << i))) continue;
+
+        const float *plane = planes.plane[i];
+        ClipVertex *to = buffers[which];
+        which ^= 1;
+
+        int kept = 0;
+        for (int a = 0; a < count; a++)
+        {
+            const ClipVertex &va = from[a];
+            const ClipVertex &vb = from[(a + 1) % count];
+            float da = Distance(plane, va), db = Distance(plane, vb);
+
+            if (da >= 0.0f)
+                to[kept++] = va;
+
+            // Edge crosses the plane. Always step from the inside end, so an
+            // edge shared by two triangles is cut at the same point
+            if ((da >= 0.0f) != (db >= 0.0f))
+                to[kept++] = da >= 0.0f ? Lerp(va, vb, da / (da - db)) : Lerp(vb, va, db / (db - da));
+        }
+
+        from = to;
+        count = kept;
+    }
+
+    if (count < 3) return 0;
+    std::copy(from, from + count, out);
+    return count;
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include <cluster.hpp>
+
+void BuildClusters(const std::vector<Vec3> &positions, std::vector<int> &indices, std::vector<int> &uvIndices, std::vector<int> &normalIndices,
+                   std::vector<SDL_Color> &colors, std::vector<Vec3> &normals, std::vector<MeshCluster> &clusters)
+{
+    int triangleCount = (int)indices.size() / 3;
+
+    // Triangles around each vertex
+    std::vector<int> vertexStart(positions.size() + 1, 0);
+    for (int v : indices)
+        vertexStart[v + 1]++;
+    for (size_t v = 0; v < positions.size(); v++)
+        vertexStart[v + 1] += vertexStart[v];
+    std::vector<int> vertexTriangles(indices.size());
+    std::vector<int> fill(vertexStart.begin(), vertexStart.end() - 1);
+    for (int i = 0; i < (int)indices.size(); i++)
+        vertexTriangles[fill[indices[i]]++] = i / 3;
+
+    // Grow each cluster breadth first from the first triangle left, through
+    // shared vertices, so it stays a compact patch
+    std::vector<int> order;
+    std::vector<bool> taken(triangleCount, false);
+    order.reserve(triangleCount);
+    clusters.clear();
+    for (int seed = 0; seed < triangleCount; seed++)
+    {
+        if (taken[seed]) continue;
+
+        MeshCluster cluster;
+        cluster.first = (int)order.size();
+        order.push_back(seed);
+        taken[seed] = true;
+        for (int next = cluster.first; next < (int)order.size() && (int)order.size() - cluster.first < CLUSTER_SIZE; next++)
+        {
+            const int *corners = &indices[3 * order[next]];
+            for (int k = 0; k < 3 && (int)order.size() - cluster.first < CLUSTER_SIZE; k++)
+                for (int i = vertexStart[corners[k]]; i < vertexStart[corners[k] + 1]; i++)
+                {
+                    int t = vertexTriangles[i];
+                    if (taken[t]) continue;
+                    order.push_back(t);
+                    taken[t] = true;
+                    if ((int)order.size() - cluster.first == CLUSTER_SIZE) break;
+                }
+        }
+        cluster.count = (int)order.size() - cluster.first;
+        clusters.push_back(cluster);
+    }
+
+    // Move the triangles into cluster order
+    bool hasNormals = normalIndices.size() == indices.size();
+    std::vector<int> oldIndices = indices, oldUVIndices = uvIndices, oldNormalIndices = normalIndices;
+    std::vector<SDL_Color> oldColors = colors;
+    for (int i = 0; i < triangleCount; i++)
+    {
+        int t = order[i];
+        for (int k = 0; k < 3; k++)
+        {
+            indices[3 * i + k] = oldIndices[3 * t + k];
+            uvIndices[3 * i + k] = oldUVIndices[3 * t + k];
+            if (hasNormals)
+                normalIndices[3 * i + k] = oldNormalIndices[3 * t + k];
+        }
+        colors[i] = oldColors[t];
+    }
+
+    // Face normals, zero for triangles without area
+    normals.resize(triangleCount);
+    for (int i = 0; i < triangleCount; i++)
+    {
+        Vec3 p0 = positions[indices[3 * i]], p1 = positions[indices[3 * i + 1]], p2 = positions[indices[3 * i + 2]];
+        Vec3 normal = (p1 - p0).cross(p2 - p0);
+        normals[i] = normal.magnitude() > 0.0f ? normal.unit() : Vec3(0.0f, 0.0f, 0.0f);
+    }
+
+    for (auto &cluster : clusters)
+    {
+        int end = cluster.first + cluster.count;
+
+        // Sphere around the box of the corners
+        Vec3 min = positions[indices[3 * cluster.first]], max = min;
+        for (int i = 3 * cluster.first; i < 3 * end; i++)
+        {
+            Vec3 p = positions[indices[i]];
+            min = {std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+            max = {std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+        }
+        cluster.center = (min + max) * 0.5f;
+        for (int i = 3 * cluster.first; i < 3 * end; i++)
+            cluster.radius = std::max(cluster.radius, Vec3::distance(positions[indices[i]], cluster.center));
+
+        // Cone from the average normal out to the farthest one. Triangles
+        // without area face nowhere and are left out
+        Vec3 axis = {0.0f, 0.0f, 0.0f};
+        for (int i = cluster.first; i < end; i++)
+            axis += normals[i];
+        if (axis.magnitude() == 0.0f)
+            continue;
+        cluster.axis = axis.unit();
+
+        float coneCos = 1.0f;
+        for (int i = cluster.first; i < end; i++)
+            if (normals[i].magnitude() > 0.0f)
+                coneCos = std::min(coneCos, normals[i].dot(cluster.axis));
+        cluster.coneCos = coneCos;
+        cluster.coneSin = std::sqrt(std::max(1.0f - coneCos * coneCos, 0.0f));
+    }
+}
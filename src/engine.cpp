@@ -1,5 +1,4 @@
 #include <iostream>
-#include <list>
 #include <algorithm>
 #include <limits>
 #include <cstdlib>
@@ -7,6 +6,21 @@
 
 #include <engine.hpp>
 
+// Per-pixel buffers are aligned to this size
+#define CACHE_LINE_SIZE 64
+
+// Size of the screen tiles rasterized in parallel. Matches the coarse level
+// of the depth pyramid, so every tile owns its own pyramid cells
+#define TILE_SIZE HIZ_TILE
+
+// Allocate a cache-line aligned buffer of count elements
+template <typename T>
+T *AllocAligned(int count)
+{
+    size_t bytes = (count * sizeof(T) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    return (T *)std::aligned_alloc(CACHE_LINE_SIZE, bytes);
+}
+
 float degToRad(float deg)
 {
     return M_PIf * deg / 180.0f;
@@ -17,154 +31,30 @@ float radToDeg(float rad)
     return rad / M_PIf * 180.0f;
 }
 
-// Common vector operations
-Vec3 IntersectPlane(Vec3 &plane_p, Vec3 &plane_n, Vec3 &lineStart, Vec3 &lineEnd, float &t)
+// Screen position of a clip space vertex, same steps as ProjectStream. Keeps
+// the clip space w
+static Vec3 ToScreen(const ClipVertex &v, int width, int height)
 {
-    plane_n = plane_n.unit();
-    float plane_d = -plane_n.dot(plane_p);
-    float ad = lineStart.dot(plane_n);
-    float bd = lineEnd.dot(plane_n);
-    t = (-plane_d - ad) / (bd - ad);
-    Vec3 lineStartToEnd = lineEnd - lineStart;
-    Vec3 lineToIntersect = lineStartToEnd * t;
-    return lineStart + lineToIntersect;
+    return {(v.x / v.w + 1.0f) * (0.5f * width), (v.y / v.w + 1.0f) * (0.5f * height), v.z / v.w + 0.0f, v.w};
 }
 
-int ClipAgainstPlane(Vec3 plane_p, Vec3 plane_n, Triangle &in_tri, Triangle &out_tri1, Triangle &out_tri2)
+// Divide UVs by the clip space w left in p.w, and store 1/w (also used as depth)
+static void ProjectTexture(Triangle &tri, bool textured)
 {
-    // Make sure plane normal is indeed normal
-    plane_n = plane_n.unit();
-
-    // Return signed shortest distance from point to plane, plane normal must be normalised
-    auto dist = [&](Vec3 &p)
-    {
-        return (plane_n.x * p.x + plane_n.y * p.y + plane_n.z * p.z - plane_n.dot(plane_p));
-    };
-
-    // Create two temporary storage arrays to classify points either side of plane
-    // If distance sign is positive, point lies on "inside" of plane
-    Vec3* inside_points[3];  int nInsidePointCount = 0;
-    Vec3* outside_points[3]; int nOutsidePointCount = 0;
-    TexUV* inside_tex[3]; int nInsideTexCount = 0;
-    TexUV* outside_tex[3]; int nOutsideTexCount = 0;
-
-    // Get signed distance of each point in triangle to plane
-    float d0 = dist(in_tri.p[0]);
-    float d1 = dist(in_tri.p[1]);
-    float d2 = dist(in_tri.p[2]);
-
-    if (d0 >= 0) {
-        inside_points[nInsidePointCount++] = &in_tri.p[0];
-        inside_tex[nInsideTexCount++] = &in_tri.t[0];
-    } else {
-        outside_points[nOutsidePointCount++] = &in_tri.p[0];
-        outside_tex[nOutsideTexCount++] = &in_tri.t[0];
-    }
-    if (d1 >= 0) {
-        inside_points[nInsidePointCount++] = &in_tri.p[1];
-        inside_tex[nInsideTexCount++] = &in_tri.t[1];
-    } else {
-        outside_points[nOutsidePointCount++] = &in_tri.p[1];
-        outside_tex[nOutsideTexCount++] = &in_tri.t[1];
-    }
-    if (d2 >= 0) {
-        inside_points[nInsidePointCount++] = &in_tri.p[2];
-        inside_tex[nInsideTexCount++] = &in_tri.t[2];
-    } else {
-        outside_points[nOutsidePointCount++] = &in_tri.p[2];
-        outside_tex[nOutsideTexCount++] = &in_tri.t[2];
-    }
-
-    // Now classify triangle points, and break the input triangle into 
-    // smaller output triangles if required. There are four possible
-    // outcomes...
-
-    if (nInsidePointCount == 0)
-    {
-        // All points lie on the outside of plane, so clip whole triangle
-        // It ceases to exist
-
-        return 0; // No returned triangles are valid
-    }
-
-    if (nInsidePointCount == 3)
-    {
-        // All points lie on the inside of plane, so do nothing
-        // and allow the triangle to simply pass through
-        out_tri1 = in_tri;
-
-        return 1; // Just the one returned original triangle is valid
-    }
-
-    if (nInsidePointCount == 1 && nOutsidePointCount == 2)
+    if (textured)
     {
-        // Triangle should be clipped. As two points lie outside
-        // the plane, the triangle simply becomes a smaller triangle
-
-        // Copy appearance info to new triangle
-        out_tri1.color = in_tri.color;
-
-        // The inside point is valid, so keep that...
-        out_tri1.p[0] = *inside_points[0];
-        out_tri1.t[0] = *inside_tex[0];
-
-        // but the two new points are at the locations where the 
-        // original sides of the triangle (lines) intersect with the plane
-        float t;
-        out_tri1.p[1] = IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0], t);
-        out_tri1.t[1].u = t * (outside_tex[0]->u - inside_tex[0]->u) + inside_tex[0]->u;
-        out_tri1.t[1].v = t * (outside_tex[0]->v - inside_tex[0]->v) + inside_tex[0]->v;
-        out_tri1.t[1].w = t * (outside_tex[0]->w - inside_tex[0]->w) + inside_tex[0]->w;
-
-        out_tri1.p[2] = IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[1], t);
-        out_tri1.t[2].u = t * (outside_tex[1]->u - inside_tex[0]->u) + inside_tex[0]->u;
-        out_tri1.t[2].v = t * (outside_tex[1]->v - inside_tex[0]->v) + inside_tex[0]->v;
-        out_tri1.t[2].w = t * (outside_tex[1]->w - inside_tex[0]->w) + inside_tex[0]->w;
-
-        return 1; // Return the newly formed single triangle
-    }
+        tri.t[0].u /= tri.p[0].w;
+        tri.t[1].u /= tri.p[1].w;
+        tri.t[2].u /= tri.p[2].w;
 
-    if (nInsidePointCount == 2 && nOutsidePointCount == 1)
-    {
-        // Triangle should be clipped. As two points lie inside the plane,
-        // the clipped triangle becomes a "quad". Fortunately, we can
-        // represent a quad with two new triangles
-
-        // Copy appearance info to new triangles
-        out_tri1.color = in_tri.color;
-        out_tri2.color = in_tri.color;
-
-        // The first triangle consists of the two inside points and a new
-        // point determined by the location where one side of the triangle
-        // intersects with the plane
-        out_tri1.p[0] = *inside_points[0];
-        out_tri1.p[1] = *inside_points[1];
-        out_tri1.t[0] = *inside_tex[0];
-        out_tri1.t[1] = *inside_tex[1];
-
-        float t;
-        out_tri1.p[2] = IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0], t);
-        out_tri1.t[2].u = t * (outside_tex[0]->u - inside_tex[0]->u) + inside_tex[0]->u;
-        out_tri1.t[2].v = t * (outside_tex[0]->v - inside_tex[0]->v) + inside_tex[0]->v;
-        out_tri1.t[2].w = t * (outside_tex[0]->w - inside_tex[0]->w) + inside_tex[0]->w;
-
-        // The second triangle is composed of one of he inside points, a
-        // new point determined by the intersection of the other side of the 
-        // triangle and the plane, and the newly created point above
-        out_tri2.p[0] = *inside_points[1];
-        out_tri2.t[0] = *inside_tex[1];
-        out_tri2.p[1] = out_tri1.p[2];
-        out_tri2.t[1] = out_tri1.t[2];
-
-        out_tri2.p[2] = IntersectPlane(plane_p, plane_n, *inside_points[1], *outside_points[0], t);
-        out_tri2.t[2].u = t * (outside_tex[0]->u - inside_tex[1]->u) + inside_tex[1]->u;
-        out_tri2.t[2].v = t * (outside_tex[0]->v - inside_tex[1]->v) + inside_tex[1]->v;
-        out_tri2.t[2].w = t * (outside_tex[0]->w - inside_tex[1]->w) + inside_tex[1]->w;
-
-        return 2; // Return two newly formed triangles which form a quad
+        tri.t[0].v /= tri.p[0].w;
+        tri.t[1].v /= tri.p[1].w;
+        tri.t[2].v /= tri.p[2].w;
     }
 
-    return 0;
+    tri.t[0].w = 1.0f / tri.p[0].w;
+    tri.t[1].w = 1.0f / tri.p[1].w;
+    tri.t[2].w = 1.0f / tri.p[2].w;
 }
 
 // Constructor
@@ -173,6 +63,7 @@ Engine3D::Engine3D()
     window = NULL;
     renderer = NULL;
     windowSurface = NULL;
+    frameTexture = NULL;
 }
 
 // Initialize
@@ -212,26 +103,112 @@ bool Engine3D::init(int width, int height)
         return false;
     }
 
+    // Streaming texture the color buffer is uploaded to once per frame
+    frameTexture = SDL_CreateTexture(renderer, FRAMEBUFFER_FORMAT, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!frameTexture)
+    {
+        std::cout << "Error creating frame texture: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    InitFrame(width, height);
+    return true;
+}
+
+bool Engine3D::initHeadless(int width, int height)
+{
+    InitFrame(width, height);
+    return true;
+}
+
+void Engine3D::InitFrame(int width, int height)
+{
     // Set size
     _width = width;
     _height = height;
-    depthBuffer = new float[_width * _height];
+
+    // Allocate color, depth and triangle ID buffers
+    colorBuffer = AllocAligned<Uint32>(_width * _height);
+    depthBuffer = AllocAligned<float>(_width * _height);
+    idBuffer = AllocAligned<Uint32>(_width * _height);
+
+    // Allocate depth pyramid
+    hizBlocksX = (_width + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    hizBlocksY = (_height + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    hizTilesX = (_width + HIZ_TILE - 1) / HIZ_TILE;
+    hizTilesY = (_height + HIZ_TILE - 1) / HIZ_TILE;
+    hizBlocks = AllocAligned<float>(hizBlocksX * hizBlocksY);
+    hizTiles = AllocAligned<float>(hizTilesX * hizTilesY);
+
+    // Create tile bins
+    tilesX = (_width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (_height + TILE_SIZE - 1) / TILE_SIZE;
+    tileBins.resize(tilesX * tilesY);
+    lineBins.resize(tilesX * tilesY);
+
+    // Rasterize on every core by default
+    SetThreadCount(0);
 
     // Set matrices
     SetFOV(cam.fov);
 
     // Set last mouse pos
     lastMousePos = {.5f * _width, .5f * _height};
-
-    return true;
 }
 
 // Add objects
 void Engine3D::addMesh(Mesh mesh)
 {
+    PrepareMesh(mesh);
     sceneMeshes.push_back(mesh);
 }
 
+void Engine3D::PrepareMesh(Mesh &mesh)
+{
+    // Triangles given one by one, bounds are updated with them. Levels
+    // simplified from the old geometry would miss them
+    if (!mesh.tris.empty())
+    {
+        mesh.BuildIndices();
+        if (!mesh.lods.empty())
+            mesh.BuildLODs();
+    }
+
+    if (mesh.normalIndices.size() != mesh.indices.size())
+        mesh.ComputeVertexNormals();
+    mesh.BuildClusters();
+}
+
+std::vector<int> Engine3D::QueryBox(Vec3 min, Vec3 max)
+{
+    std::vector<int> found;
+    sceneTree.Update(sceneMeshes);
+    sceneTree.QueryBox(min, max, found);
+    return found;
+}
+
+std::vector<int> Engine3D::QueryRadius(Vec3 center, float radius)
+{
+    std::vector<int> found;
+    sceneTree.Update(sceneMeshes);
+    sceneTree.QueryRadius(center, radius, found);
+    return found;
+}
+
+std::vector<int> Engine3D::QueryFrustum(Frustum frustum)
+{
+    std::vector<int> found;
+    sceneTree.Update(sceneMeshes);
+    sceneTree.QueryFrustum(frustum, found);
+    return found;
+}
+
+Frustum Engine3D::ViewFrustum()
+{
+    Mat4 matView = Mat4::LookAt(cam.position, cam.position + cam.forward, cam.up).QuickInverse();
+    return Frustum::FromProjection(matProj, cam.near, cam.far).Transformed(matView);
+}
+
 void Engine3D::addLight(Light light)
 {
     lights.push_back(light);
@@ -240,6 +217,23 @@ void Engine3D::addLight(Light light)
 // Destructor
 Engine3D::~Engine3D()
 {
+    std::free(colorBuffer);
+    std::free(depthBuffer);
+    std::free(idBuffer);
+    std::free(hizBlocks);
+    std::free(hizTiles);
+    colorBuffer = NULL;
+    depthBuffer = NULL;
+    idBuffer = NULL;
+    hizBlocks = NULL;
+    hizTiles = NULL;
+
+    if (frameTexture)
+    {
+        SDL_DestroyTexture(frameTexture);
+        frameTexture = NULL;
+    }
+
     if (windowSurface)
     {
         SDL_FreeSurface(windowSurface);
@@ -342,6 +336,18 @@ void Engine3D::SetFPS(int fps)
     printf("Delay (ms): %d\n", delay_ms);
 }
 
+void Engine3D::SetThreadCount(int count)
+{
+    if (count <= 0)
+        count = SDL_GetCPUCount();
+    threadPool.SetThreadCount(count);
+}
+
+int Engine3D::GetThreadCount()
+{
+    return threadPool.GetThreadCount();
+}
+
 // Default camera controls
 void Engine3D::DefaultCameraMovement(float dt)
 {
@@ -392,230 +398,368 @@ void Engine3D::draw()
     // Clear screen
     Fill();
 
-    // Clear depth buffer
-    for (int i = 0; i < _width * _height; i++)
-        depthBuffer[i] = std::numeric_limits<float>::infinity();
+    // Clear depth buffer and pyramid
+    float farthest = std::numeric_limits<float>::infinity();
+    std::fill(depthBuffer, depthBuffer + _width * _height, farthest);
+    std::fill(hizBlocks, hizBlocks + hizBlocksX * hizBlocksY, farthest);
+    std::fill(hizTiles, hizTiles + hizTilesX * hizTilesY, farthest);
+    if (visibilityBuffer)
+        std::fill(idBuffer, idBuffer + _width * _height, VISIBILITY_EMPTY);
 
-    // Loop through every scene mesh
-    for (auto& mesh : sceneMeshes)
-    {
-        // Apply rotation
-        Mat4 matRotZ = Mat4::AxisAngle({0.0f, 0.0f, 1.0f}, mesh.rotation.z);
-        Mat4 matRotY = Mat4::AxisAngle({0.0f, 1.0f, 0.0f}, mesh.rotation.y);
-        Mat4 matRotX = Mat4::AxisAngle({1.0f, 0.0f, 0.0f}, mesh.rotation.x);
+    // Clear triangle queues
+    rasterQueue.clear();
+    rasterKeys.clear();
+    lineQueue.clear();
 
-        Mat4 matTrans = Mat4::Translation(mesh.position * Vec3(1.0f, 1.0f, 1.0f));
-        Mat4 matWorld = Mat4::Identity() * matRotZ * matRotY * matRotX * matTrans;
+    // Camera look at matrix
+    Mat4 matCamera = Mat4::LookAt(cam.position, cam.position + cam.forward, cam.up);
 
-        // Camera look at matrix
-        Mat4 matCamera = Mat4::LookAt(cam.position, cam.position + cam.forward, cam.up);
+    // Make view from camera
+    Mat4 matView = matCamera.QuickInverse();
 
-        // Make view from camera
-        Mat4 matView = matCamera.QuickInverse();
+    // View space frustum, meshes are tested against it before any per-triangle work
+    Frustum frustum = Frustum::FromProjection(matProj, cam.near, cam.far);
 
-        // Project triangles
-        std::vector<Triangle> trianglesToRaster;
-        for (auto& tri : mesh.tris)
-        {
-            // Scale points
-            Triangle scaledTri;
-            scaledTri.p[0] = tri.p[0] * mesh.size;
-            scaledTri.p[1] = tri.p[1] * mesh.size;
-            scaledTri.p[2] = tri.p[2] * mesh.size;
+    // Same volume in clip space, widened to the guard band, for triangles
+    ClipPlanes clipPlanes = ClipPlanes::FromProjection(matProj, cam.near, cam.far, _width, _height);
 
-            Triangle triProjected, triTransformed, triViewed;
-            for (int i = 0; i < 3; i++)
+    // Each light as the unit direction towards it and its brightness
+    lightData.clear();
+    for (Light &light : lights)
+    {
+        Vec3 towards = -light.direction.unit();
+        lightData.insert(lightData.end(), {towards.x, towards.y, towards.z, light.brightness});
+    }
+
+    // Triangles added one by one since the last frame, before the tree
+    // picks up the new bounds
+    for (Mesh &mesh : sceneMeshes)
+        if (!mesh.tris.empty())
+            PrepareMesh(mesh);
+
+    // Meshes that may be in view, culled through the scene tree in world space.
+    // Scene order, so meshes queue their triangles the same way every frame
+    sceneTree.Update(sceneMeshes);
+    Frustum worldFrustum = frustum.Transformed(matView);
+    sceneTree.CullFrustum(worldFrustum, visibleMeshes, visibleInside);
+    std::sort(visibleMeshes.begin(), visibleMeshes.end());
+
+    // Loop through every visible mesh
+    for (int meshIndex : visibleMeshes)
+    {
+        Mesh &mesh = sceneMeshes[meshIndex];
+        Mat4 matWorld = mesh.WorldMatrix();
+
+        // Skip meshes out of view, and clipping for meshes fully in view.
+        // Meshes the tree found inside need no test, otherwise the sphere
+        // settles most meshes and the box corners the rest
+        Vec3 center = matView * (matWorld * (mesh.boundsCenter * mesh.size));
+        float scale = std::max({std::abs(mesh.size.x), std::abs(mesh.size.y), std::abs(mesh.size.z)});
+        FrustumTest visibility = visibleInside[meshIndex] ? FrustumTest::Inside : FrustumTest::Intersects;
+        if (visibility == FrustumTest::Intersects)
+            visibility = frustum.TestSphere(center, mesh.boundsRadius * scale);
+        if (visibility == FrustumTest::Intersects)
+        {
+            Vec3 corners[8];
+            for (int i = 0; i < 8; i++)
             {
-                triTransformed.p[i] = matWorld * scaledTri.p[i];
-                triTransformed.t[i] = tri.t[i];
+                Vec3 corner = {
+                    i & 1 ? mesh.boundsMax.x : mesh.boundsMin.x,
+                    i & 2 ? mesh.boundsMax.y : mesh.boundsMin.y,
+                    i & 4 ? mesh.boundsMax.z : mesh.boundsMin.z
+                };
+                corners[i] = matView * (matWorld * (corner * mesh.size));
             }
+            visibility = frustum.TestPoints(corners, 8);
+        }
+        if (visibility == FrustumTest::Outside)
+            continue;
+        bool inside = visibility == FrustumTest::Inside;
+
+        // Level of detail from how big a model unit shows at the nearest
+        // point of the bounding sphere
+        float distance = std::max(center.magnitude() - mesh.boundsRadius * scale, cam.near);
+        float unitPixels = scale * std::abs(matProj.m[1][1]) * 0.5f * _height / distance;
+        int level = mesh.SelectLOD(unitPixels, lodPixelError);
+        const std::vector<Vec3> &positions = level ? mesh.lods[level - 1].positions : mesh.positions;
+        const std::vector<int> &indices = level ? mesh.lods[level - 1].indices : mesh.indices;
+        const std::vector<int> &uvIndices = level ? mesh.lods[level - 1].uvIndices : mesh.uvIndices;
+        const std::vector<int> &normalIndices = level ? mesh.lods[level - 1].normalIndices : mesh.normalIndices;
+        int normalBegin = level ? mesh.lods[level - 1].normalBegin : mesh.normalBegin;
+        int normalEnd = level ? mesh.lods[level - 1].normalEnd : mesh.normalEnd;
+        const std::vector<SDL_Color> &colors = level ? mesh.lods[level - 1].colors : mesh.colors;
+        const std::vector<Vec3> &normals = level ? mesh.lods[level - 1].normals : mesh.normals;
+        const std::vector<MeshCluster> &clusters = level ? mesh.lods[level - 1].clusters : mesh.clusters;
+
+        // Transform each unique vertex once, in batches
+        RasterPath path = rasterizer.path;
+        TransformPositions(path, matWorld, positions.data(), mesh.size, (int)positions.size(), worldVertices);
+        TransformStream(path, matView, worldVertices, viewVertices);
+        ProjectStream(path, matProj, clipPlanes, viewVertices, _width, _height, screenVertices, screenCodes);
+
+        // Camera in model space, where the face planes are
+        Vec3 eye = matWorld.QuickInverse() * cam.position / mesh.size;
+
+        // Faces towards the camera, skipping whole clusters facing away
+        visibleFaces.clear();
+        for (const MeshCluster &cluster : clusters)
+        {
+            if (cluster.BackFacing(eye))
+                continue;
 
-            // Calculate triangle normal
-            Vec3 normal, line1, line2;
-            line1 = triTransformed.p[1] - triTransformed.p[0];
-            line2 = triTransformed.p[2] - triTransformed.p[0];
-
-            // Cross product
-            normal = line1.cross(line2).unit();
-
-            // Get ray from triangle to camera
-            Vec3 cameraRay = triTransformed.p[0] - cam.position;
-
-            if (normal.dot(cameraRay) < 0.0f)
+            for (int triIndex = cluster.first; triIndex < cluster.first + cluster.count; triIndex++)
             {
-                // Calculate color based on illumination
-                // Illumination
-                Vec3 lightDir = lights[0].direction.unit();
-
-                // Get face luminance
-                float d = std::clamp(normal.dot(-lightDir), 0.1f, 1.0f);
+                const Vec3 &n = normals[triIndex];
+                const Vec3 &p0 = positions[indices[3 * triIndex]];
+                if ((eye.x - p0.x) * n.x + (eye.y - p0.y) * n.y + (eye.z - p0.z) * n.z > 0.0f)
+                    visibleFaces.push_back(triIndex);
+            }
+        }
+        int faceCount = (int)visibleFaces.size();
+
+        // Light the faces in one pass over their normals, taken to world space
+        // by the rotation alone, over the scale. Smooth meshes light each
+        // vertex normal of its level once instead. Textures shade themselves
+        bool flat = !mesh.texture.loaded || mesh.texture.isBaseColor;
+        bool smooth = flat && smoothShading && normalIndices.size() == indices.size();
+        if (flat)
+        {
+            int normalCount = smooth ? normalEnd - normalBegin : faceCount;
+            modelNormals.Resize(normalCount);
+            for (int i = 0; i < normalCount; i++)
+            {
+                const Vec3 &n = smooth ? mesh.vertexNormals[normalBegin + i] : normals[visibleFaces[i]];
+                modelNormals.x[i] = n.x / mesh.size.x;
+                modelNormals.y[i] = n.y / mesh.size.y;
+                modelNormals.z[i] = n.z / mesh.size.z;
+                modelNormals.w[i] = 0.0f;
+            }
+            Mat4 matRotation = matWorld;
+            matRotation.m[3][0] = matRotation.m[3][1] = matRotation.m[3][2] = 0.0f;
+            TransformStream(path, matRotation, modelNormals, worldNormals);
+            LightStream(path, worldNormals, lightData.data(), (int)lights.size(), ambientLight, normalLight);
+        }
 
-                // Set luminance
-                HSL hsl;
+        // Project triangles
+        trianglesToRaster.clear();
+        for (int face = 0; face < faceCount; face++)
+        {
+            int triIndex = visibleFaces[face];
+            const int *index = &indices[3 * triIndex];
+            const int *uvIndex = &uvIndices[3 * triIndex];
 
-                // If has texture and is base color
-                if (mesh.texture.loaded && mesh.texture.isBaseColor)
+            Triangle triProjected;
+            TexUV uv[3] = {mesh.uvs[uvIndex[0]], mesh.uvs[uvIndex[1]], mesh.uvs[uvIndex[2]]};
+            if (flat)
+            {
+                SDL_Color base = mesh.texture.loaded ? mesh.texture.baseColor : colors[triIndex];
+                if (smooth)
                 {
-                    hsl.FromRGB(mesh.texture.baseColor);
+                    const int *normalIndex = &normalIndices[3 * triIndex];
+                    for (int i = 0; i < 3; i++)
+                        triProjected.vertexColors[i] = ShadeColor(base, normalLight[normalIndex[i] - normalBegin]);
+                    triProjected.smooth = true;
                 }
                 else
+                    triProjected.color = ShadeColor(base, normalLight[face]);
+            }
+
+            // Corners inside every clip plane take the projected vertices
+            // as they are, triangles with all corners outside one plane are dropped
+            int code0 = screenCodes[index[0]], code1 = screenCodes[index[1]], code2 = screenCodes[index[2]];
+            if (inside || (code0 | code1 | code2) == 0)
+            {
+                for (int i = 0; i < 3; i++)
                 {
-                    hsl.FromRGB(tri.color);
+                    triProjected.p[i] = screenVertices.Get(index[i]);
+                    triProjected.t[i] = uv[i];
                 }
 
-                // Multiply by light brightness
-                hsl.L *= d * lights[0].brightness;
-                triProjected.color = hsl.ToRGB();
+                ProjectTexture(triProjected, mesh.texture.loaded);
+                trianglesToRaster.push_back(triProjected);
+                continue;
+            }
+            if (code0 & code1 & code2)
+                continue;
 
-                // Convert from World Space to View Space
-                for (int i = 0; i < 3; i++) {
-                    triViewed.p[i] = matView * triTransformed.p[i];
-                    triViewed.t[i] = triTransformed.t[i];
-                }
+            // Clip in clip space against the planes crossed, then fan
+            // the polygon left into triangles
+            ClipVertex corners[3], polygon[CLIP_MAX_VERTICES];
+            for (int i = 0; i < 3; i++)
+            {
+                Vec3 c = matProj * viewVertices.Get(index[i]);
+                SDL_Color vc = triProjected.vertexColors[i];
+                corners[i] = {c.x, c.y, c.z, c.w, uv[i], (float)vc.r, (float)vc.g, (float)vc.b};
+            }
+            int count = ClipPolygon(clipPlanes, code0 | code1 | code2, corners, 3, polygon);
 
-                // Clip viewed triangle against near plane, this could
-                // form two additional triangles
-                Triangle clipped[2];
-                int clippedTriangles = ClipAgainstPlane(
-                    {0.0f, 0.0f, 0.1f},
-                    {0.0f, 0.0f, 1.0f},
-                    triViewed,
-                    clipped[0],
-                    clipped[1]
-                );
-
-                for (int n = 0; n < clippedTriangles; n++)
+            for (int k = 1; k + 1 < count; k++)
+            {
+                const ClipVertex *fan[3] = {&polygon[0], &polygon[k], &polygon[k + 1]};
+                for (int i = 0; i < 3; i++)
                 {
-                    // Project from 3D to 2D
-                    for (int i = 0; i < 3; i++)
-                    {
-                        triProjected.p[i] = matProj * clipped[n].p[i];
-                        triProjected.t[i] = clipped[n].t[i];
-                    }
-
-                    // Project texture
-                    if (mesh.texture.loaded)
-                    {
-                        triProjected.t[0].u /= triProjected.p[0].w;
-                        triProjected.t[1].u /= triProjected.p[1].w;
-                        triProjected.t[2].u /= triProjected.p[2].w;
-
-                        triProjected.t[0].v /= triProjected.p[0].w;
-                        triProjected.t[1].v /= triProjected.p[1].w;
-                        triProjected.t[2].v /= triProjected.p[2].w;
-
-                        triProjected.t[0].w = 1.0f / triProjected.p[0].w;
-                        triProjected.t[1].w = 1.0f / triProjected.p[1].w;
-                        triProjected.t[2].w = 1.0f / triProjected.p[2].w;
-                    }
-
-                    // Apply position modifiers
-                    Vec3 offsetView = {1.0f, 1.0f, 0.0f};
-                    for (int i = 0; i < 3; i++)
-                    {
-                        // Scale into view
-                        triProjected.p[i] /= triProjected.p[i].w;
-
-                        // Offset into visible space
-                        triProjected.p[i] += offsetView;
-                        triProjected.p[i].x *= 0.5f * _width;
-                        triProjected.p[i].y *= 0.5f * _height;
-                    }
-
-                    // Store triangle for sorting
-                    trianglesToRaster.push_back(triProjected);
+                    triProjected.p[i] = ToScreen(*fan[i], _width, _height);
+                    triProjected.t[i] = fan[i]->t;
                 }
+                for (int i = 0; i < 3 && triProjected.smooth; i++)
+                    triProjected.vertexColors[i] = {(Uint8)(fan[i]->r + 0.5f), (Uint8)(fan[i]->g + 0.5f), (Uint8)(fan[i]->b + 0.5f), SDL_ALPHA_OPAQUE};
+
+                ProjectTexture(triProjected, mesh.texture.loaded);
+
+                // Store triangle for sorting
+                trianglesToRaster.push_back(triProjected);
             }
         }
 
-        // Sort triangles
-        std::sort(trianglesToRaster.begin(), trianglesToRaster.end(), [](Triangle& t1, Triangle& t2) {
-            float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3.0f;
-            float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3.0f;
-
-            return z1 < z2;
-        });
+        // Flat triangles need the depth test to be drawn front to back. Drawn
+        // in order, they still write depth when lines are hidden behind them
+        bool depthTest = mesh.texture.loaded || renderOrder == RenderOrder::FrontToBack;
+        bool depthWrite = !depthTest && drawWireframe && wireframeDepthTest;
+        Uint32 material = (Uint32)(&mesh - sceneMeshes.data()) & 0xFF;
 
-        // Clipping
-        for (Triangle& triToRaster : trianglesToRaster)
+        // Queue triangles
+        for (Triangle& t : trianglesToRaster)
         {
-            // Clip triangles against all four screen edges, this could
-            // yield a bunch of triangles
-            Triangle clipped[2];
-            std::list<Triangle> listTriangles;
-            listTriangles.push_back(triToRaster);
-            int newTriangles = 1;
-
-            for (int p = 0; p < 4; p++)
+            // Triangles may reach into the guard band, where the rasterizer
+            // scissors them. Skip the ones entirely off one side of the screen
+            if (std::max({t.p[0].x, t.p[1].x, t.p[2].x}) < 0.0f || std::min({t.p[0].x, t.p[1].x, t.p[2].x}) > _width ||
+                std::max({t.p[0].y, t.p[1].y, t.p[2].y}) < 0.0f || std::min({t.p[0].y, t.p[1].y, t.p[2].y}) > _height)
+                continue;
+
+            // Sort key, average depth on top and mesh below so that triangles
+            // at the same depth are grouped by material. Projected z grows
+            // towards the camera
+            float z = (t.p[0].z + t.p[1].z + t.p[2].z) / 3.0f;
+            Uint32 depthKey = FloatSortKey(z);
+            if (renderOrder == RenderOrder::FrontToBack)
+                depthKey = ~depthKey;
+            Uint32 key = (depthKey & 0xFFFFFF00u) | material;
+
+            // Queue the transformed, viewed, clipped, projected triangle
+            RasterTriangle tri;
+            for (int i = 0; i < 3; i++)
             {
-                int trisToAdd = 0;
-                while (newTriangles > 0)
-                {
-                    // Take triangle from front of queue
-                    Triangle test = listTriangles.front();
-                    listTriangles.pop_front();
-                    newTriangles--;
-
-                    // Clip it against a plane
-                    switch (p)
-                        {
-                        case 0:
-                            trisToAdd = ClipAgainstPlane({0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, test, clipped[0], clipped[1]);
-                            break;
-                        case 1:
-                            trisToAdd = ClipAgainstPlane({0.0f, (float)_height - 1, 0.0f}, {0.0f, -1.0f, 0.0f}, test, clipped[0], clipped[1]);
-                            break;
-                        case 2:
-                            trisToAdd = ClipAgainstPlane({0.0f, 0.0f, 0.0f}, { 1.0f, 0.0f, 0.0f}, test, clipped[0], clipped[1]);
-                            break;
-                        case 3:
-                            trisToAdd = ClipAgainstPlane({(float)_width - 1, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, test, clipped[0], clipped[1]);
-                            break;
-                        }
-
-                    // Clipping may yield a variable number of triangles, so
-                    // add these new ones to the back of the queue for subsequent
-                    // clipping against next planes
-                    for (int w = 0; w < trisToAdd; w++)
-                        listTriangles.push_back(clipped[w]);
-                }
-                newTriangles = listTriangles.size();
+                tri.p[i] = {t.p[i].x, t.p[i].y};
+                tri.t[i] = t.t[i];
             }
-
-            // Draw the transformed, viewed, clipped, projected, sorted, clipped triangles
-            for (auto &t : listTriangles)
-            {
-                if (mesh.texture.loaded)
+            tri.color = t.color;
+            for (int i = 0; i < 3; i++)
+                tri.colors[i] = t.vertexColors[i];
+            tri.smooth = t.smooth;
+            tri.texture = mesh.texture.loaded ? &mesh.texture : NULL;
+            tri.depthTest = depthTest;
+            tri.depthWrite = depthWrite;
+            rasterKeys.push_back({key, (int)rasterQueue.size()});
+            rasterQueue.push_back(tri);
+
+            if (drawWireframe)
+                for (int i = 0; i < 3; i++)
                 {
-                    TexturedTriangle(
-                        {t.p[0].x, t.p[0].y},
-                        t.t[0],
-                        {t.p[1].x, t.p[1].y},
-                        t.t[1],
-                        {t.p[2].x, t.p[2].y},
-                        t.t[2],
-                        mesh.texture,
-                        t.color
-                    );
-                } else {
-                    FillTriangle(
-                        {t.p[0].x, t.p[0].y},
-                        {t.p[1].x, t.p[1].y},
-                        {t.p[2].x, t.p[2].y},
-                        t.color
-                    );
+                    RasterLine line;
+                    line.p[0] = tri.p[i];
+                    line.p[1] = tri.p[(i + 1) % 3];
+                    line.z[0] = tri.t[i].w;
+                    line.z[1] = tri.t[(i + 1) % 3].w;
+                    line.color = PackColor({255, 255, 255, 255});
+                    line.depthTest = wireframeDepthTest;
+                    lineQueue.push_back(line);
                 }
-
-                if (drawWireframe)
-                    RenderTriangle(
-                        {t.p[0].x, t.p[0].y},
-                        {t.p[1].x, t.p[1].y},
-                        {t.p[2].x, t.p[2].y},
-                        {255, 255, 255, 255}
-                    );
-            }
         }
     }
+
+    // Sort the whole frame at once, the sort is stable so pieces of a
+    // clipped triangle stay together and in order
+    RadixSort(rasterKeys, sortScratch);
+    sortedQueue.resize(rasterQueue.size());
+    for (int i = 0; i < (int)rasterKeys.size(); i++)
+        sortedQueue[i] = rasterQueue[rasterKeys[i].index];
+    rasterQueue.swap(sortedQueue);
+
+    // Draw queued triangles
+    RasterizeQueue();
+
+    // Wireframe goes on top of everything
+    DrawLineQueue();
+}
+
+void Engine3D::RasterizeQueue()
+{
+    RenderTarget screen = ScreenTarget();
+    if (visibilityBuffer)
+        screen.ids = idBuffer;
+
+    // Set up every triangle once and bin it into the tiles it touches
+    for (auto &bin : tileBins)
+        bin.clear();
+    rasterSetups.resize(rasterQueue.size());
+    for (int i = 0; i < (int)rasterQueue.size(); i++)
+    {
+        TriangleSetup &s = rasterSetups[i];
+        if (!rasterizer.SetupTriangle(screen, rasterQueue[i], s))
+            continue;
+        s.id = i;
+
+        for (int ty = s.minY / TILE_SIZE; ty <= s.maxY / TILE_SIZE; ty++)
+            for (int tx = s.minX / TILE_SIZE; tx <= s.maxX / TILE_SIZE; tx++)
+                tileBins[ty * tilesX + tx].push_back(i);
+    }
+
+    // Each tile owns its pixels, so tiles need no locks. Triangles keep
+    // their queue order inside a tile, which makes the output identical
+    // to drawing the queue serially
+    threadPool.ParallelFor(tilesX * tilesY, [&](int tile)
+    {
+        RenderTarget target = screen;
+        target.minX = (tile % tilesX) * TILE_SIZE;
+        target.minY = (tile / tilesX) * TILE_SIZE;
+        target.maxX = std::min(target.minX + TILE_SIZE, _width);
+        target.maxY = std::min(target.minY + TILE_SIZE, _height);
+
+        for (int i : tileBins[tile])
+            rasterizer.DrawSetup(target, rasterSetups[i]);
+    });
+
+    // Shade what ended up visible, rows are independent
+    if (visibilityBuffer)
+        threadPool.ParallelFor(_height, [&](int y)
+        {
+            rasterizer.ResolveRow(screen, rasterSetups.data(), y);
+        });
+}
+
+void Engine3D::DrawLineQueue()
+{
+    if (lineQueue.empty()) return;
+
+    RenderTarget screen = ScreenTarget();
+
+    // Bin by bounding box, lines are clipped to each tile when drawn
+    for (auto &bin : lineBins)
+        bin.clear();
+    for (int i = 0; i < (int)lineQueue.size(); i++)
+    {
+        const RasterLine &line = lineQueue[i];
+        int minX = std::max(0, (int)std::floor(std::min(line.p[0].x, line.p[1].x)));
+        int maxX = std::min(_width - 1, (int)std::floor(std::max(line.p[0].x, line.p[1].x)));
+        int minY = std::max(0, (int)std::floor(std::min(line.p[0].y, line.p[1].y)));
+        int maxY = std::min(_height - 1, (int)std::floor(std::max(line.p[0].y, line.p[1].y)));
+
+        for (int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ty++)
+            for (int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; tx++)
+                lineBins[ty * tilesX + tx].push_back(i);
+    }
+
+    threadPool.ParallelFor(tilesX * tilesY, [&](int tile)
+    {
+        RenderTarget target = screen;
+        target.minX = (tile % tilesX) * TILE_SIZE;
+        target.minY = (tile / tilesX) * TILE_SIZE;
+        target.maxX = std::min(target.minX + TILE_SIZE, _width);
+        target.maxY = std::min(target.minY + TILE_SIZE, _height);
+
+        for (int i : lineBins[tile])
+            rasterizer.DrawLine(target, lineQueue[i]);
+    });
 }
 
 // Main loop
@@ -670,7 +814,9 @@ void Engine3D::run()
         title << "SDL Engine 3D | " << (int)(1.0f / dt) << " fps";
         SDL_SetWindowTitle(window, title.str().c_str());
 
-        // Update renderer
+        // Upload color buffer and present it
+        SDL_UpdateTexture(frameTexture, NULL, colorBuffer, _width * sizeof(Uint32));
+        SDL_RenderCopy(renderer, frameTexture, NULL, NULL);
         SDL_RenderPresent(renderer);
 
         // Delay
@@ -681,23 +827,49 @@ void Engine3D::run()
 // Drawing
 void Engine3D::Fill(SDL_Color color)
 {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-    SDL_RenderClear(renderer);
+    std::fill(colorBuffer, colorBuffer + _width * _height, PackColor(color));
 }
 
 void Engine3D::RenderPoint(Vec2 p, SDL_Color color)
 {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-    SDL_RenderDrawPointF(renderer, p.x, p.y);
+    int x = (int)p.x;
+    int y = (int)p.y;
+    if (x < 0 || x >= _width || y < 0 || y >= _height) return;
+
+    colorBuffer[y * _width + x] = PackColor(color);
+}
+
+void Engine3D::DrawSpan(int x0, int x1, int y, Uint32 color)
+{
+    if (y < 0 || y >= _height) return;
+    if (x0 > x1) std::swap(x0, x1);
+
+    // Clamp to screen
+    x0 = std::max(x0, 0);
+    x1 = std::min(x1, _width - 1);
+    if (x0 > x1) return;
+
+    Uint32 *row = colorBuffer + y * _width;
+    std::fill(row + x0, row + x1 + 1, color);
+}
+
+// Line with both end points included
+void Engine3D::DrawLine(int x0, int y0, int x1, int y1, Uint32 color)
+{
+    RasterLine line;
+    line.p[0] = {(float)x0, (float)y0};
+    line.p[1] = {(float)x1, (float)y1};
+    line.color = color;
+    rasterizer.DrawLine(ScreenTarget(), line);
 }
 
 void Engine3D::RenderTriangle(Vec2 p0, Vec2 p1, Vec2 p2, SDL_Color color)
 {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+    Uint32 pixel = PackColor(color);
 
-    SDL_RenderDrawLine(renderer, (int)p0.x, (int)p0.y, (int)p1.x, (int)p1.y);
-    SDL_RenderDrawLine(renderer, (int)p1.x, (int)p1.y, (int)p2.x, (int)p2.y);
-    SDL_RenderDrawLine(renderer, (int)p2.x, (int)p2.y, (int)p0.x, (int)p0.y);
+    DrawLine((int)p0.x, (int)p0.y, (int)p1.x, (int)p1.y, pixel);
+    DrawLine((int)p1.x, (int)p1.y, (int)p2.x, (int)p2.y, pixel);
+    DrawLine((int)p2.x, (int)p2.y, (int)p0.x, (int)p0.y, pixel);
 }
 
 /* My attempt (not perfect), reading from:
@@ -705,7 +877,7 @@ http://www.sunshine2k.de/coding/java/TriangleRasterization/TriangleRasterization
 */
 void Engine3D::FillTriangleOld(Vec2 p0, Vec2 p1, Vec2 p2, SDL_Color color)
 {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+    Uint32 pixel = PackColor(color);
 
     // Create array
     std::array<Vec2, 3> vecList = {p0, p1, p2};
@@ -734,7 +906,7 @@ void Engine3D::FillTriangleOld(Vec2 p0, Vec2 p1, Vec2 p2, SDL_Color color)
         float x0 = vecList[0].x + incX0 * i;
         float x1 = vecList[0].x + incX1 * i;
 
-        SDL_RenderDrawLine(renderer, x0, y, x1, y);
+        DrawSpan(x0, x1, y, pixel);
     }
 
     // BOTTOM PART
@@ -753,397 +925,91 @@ void Engine3D::FillTriangleOld(Vec2 p0, Vec2 p1, Vec2 p2, SDL_Color color)
         float x0 = vecList[1].x + incX0 * i;
         float x1 = x3 + incX1 * i;
 
-        SDL_RenderDrawLine(renderer, x0, y, x1, y);
+        DrawSpan(x0, x1, y, pixel);
     }
 }
 
-/* Taken from:
-https://github.com/OneLoneCoder/Javidx9/blob/master/ConsoleGameEngine/olcConsoleGameEngine.h
-on line 537
-*/
 void Engine3D::FillTriangle(Vec2 p0, Vec2 p1, Vec2 p2, SDL_Color color)
 {
-    int x1 = (int)p0.x;
-    int x2 = (int)p1.x;
-    int x3 = (int)p2.x;
-    int y1 = (int)p0.y;
-    int y2 = (int)p1.y;
-    int y3 = (int)p2.y;
-    auto swap = [](int &x, int &y) { int t = x; x = y; y = t; };
-    auto drawline = [&](int sx, int ex, int ny) { for (int i = sx; i <= ex; i++) RenderPoint({(float)i, (float)ny}, color); };
-
-    int t1x, t2x, y, minx, maxx, t1xp, t2xp;
-    bool changed1 = false;
-    bool changed2 = false;
-    int signx1, signx2, dx1, dy1, dx2, dy2;
-    int e1, e2;
-    // Sort vertices
-    if (y1>y2) { swap(y1, y2); swap(x1, x2); }
-    if (y1>y3) { swap(y1, y3); swap(x1, x3); }
-    if (y2>y3) { swap(y2, y3); swap(x2, x3); }
-
-    t1x = t2x = x1; y = y1;   // Starting points
-    dx1 = (int)(x2 - x1); if (dx1<0) { dx1 = -dx1; signx1 = -1; }
-    else signx1 = 1;
-    dy1 = (int)(y2 - y1);
-
-    dx2 = (int)(x3 - x1); if (dx2<0) { dx2 = -dx2; signx2 = -1; }
-    else signx2 = 1;
-    dy2 = (int)(y3 - y1);
-
-    if (dy1 > dx1) {   // swap values
-        swap(dx1, dy1);
-        changed1 = true;
-    }
-    if (dy2 > dx2) {   // swap values
-        swap(dy2, dx2);
-        changed2 = true;
-    }
+    RasterTriangle tri;
+    tri.p[0] = p0; tri.p[1] = p1; tri.p[2] = p2;
+    tri.color = color;
 
-    e2 = (int)(dx2 >> 1);
-    // Flat top, just process the second half
-    if (y1 == y2) goto next;
-    e1 = (int)(dx1 >> 1);
-
-    for (int i = 0; i < dx1;) {
-        t1xp = 0; t2xp = 0;
-        if (t1x<t2x) { minx = t1x; maxx = t2x; }
-        else { minx = t2x; maxx = t1x; }
-        // process first line until y value is about to change
-        while (i<dx1) {
-            i++;
-            e1 += dy1;
-            while (e1 >= dx1) {
-                e1 -= dx1;
-                if (changed1) t1xp = signx1;//t1x += signx1;
-                else          goto next1;
-            }
-            if (changed1) break;
-            else t1x += signx1;
-        }
-        // Move line
-    next1:
-        // process second line until y value is about to change
-        while (1) {
-            e2 += dy2;
-            while (e2 >= dx2) {
-                e2 -= dx2;
-                if (changed2) t2xp = signx2;//t2x += signx2;
-                else          goto next2;
-            }
-            if (changed2)     break;
-            else              t2x += signx2;
-        }
-    next2:
-        if (minx>t1x) minx = t1x;
-        if (minx>t2x) minx = t2x;
-        if (maxx<t1x) maxx = t1x;
-        if (maxx<t2x) maxx = t2x;
-        drawline(minx, maxx, y);    // Draw line from min to max points found on the y
-                                        // Now increase y
-        if (!changed1) t1x += signx1;
-        t1x += t1xp;
-        if (!changed2) t2x += signx2;
-        t2x += t2xp;
-        y += 1;
-        if (y == y2) break;
-
-    }
-    next:
-        // Second half
-        dx1 = (int)(x3 - x2); if (dx1<0) { dx1 = -dx1; signx1 = -1; }
-        else signx1 = 1;
-        dy1 = (int)(y3 - y2);
-        t1x = x2;
-
-        if (dy1 > dx1) {   // swap values
-            swap(dy1, dx1);
-            changed1 = true;
-        }
-        else changed1 = false;
-
-        e1 = (int)(dx1 >> 1);
-
-        for (int i = 0; i <= dx1; i++) {
-            t1xp = 0; t2xp = 0;
-            if (t1x<t2x) { minx = t1x; maxx = t2x; }
-            else { minx = t2x; maxx = t1x; }
-            // process first line until y value is about to change
-            while (i<dx1) {
-                e1 += dy1;
-                while (e1 >= dx1) {
-                    e1 -= dx1;
-                    if (changed1) { t1xp = signx1; break; }//t1x += signx1;
-                    else          goto next3;
-                }
-                if (changed1) break;
-                else   	   	  t1x += signx1;
-                if (i<dx1) i++;
-            }
-        next3:
-            // process second line until y value is about to change
-            while (t2x != x3) {
-                e2 += dy2;
-                while (e2 >= dx2) {
-                    e2 -= dx2;
-                    if (changed2) t2xp = signx2;
-                    else          goto next4;
-                }
-                if (changed2)     break;
-                else              t2x += signx2;
-            }
-        next4:
-
-            if (minx>t1x) minx = t1x;
-            if (minx>t2x) minx = t2x;
-            if (maxx<t1x) maxx = t1x;
-            if (maxx<t2x) maxx = t2x;
-            drawline(minx, maxx, y);   										
-            if (!changed1) t1x += signx1;
-            t1x += t1xp;
-            if (!changed2) t2x += signx2;
-            t2x += t2xp;
-            y += 1;
-            if (y>y3) return;
-        }
+    rasterizer.DrawTriangle(ScreenTarget(), tri);
 }
 
-void Engine3D::TexturedTriangle(Vec2 p0, TexUV tex0, Vec2 p1, TexUV tex1, Vec2 p2, TexUV tex2, Texture texture, SDL_Color color)
+void Engine3D::TexturedTriangle(Vec2 p0, TexUV tex0, Vec2 p1, TexUV tex1, Vec2 p2, TexUV tex2, const Texture &texture, SDL_Color color)
 {
-    // Convert positions to int
-    int x1 = (int)p0.x;
-    int x2 = (int)p1.x;
-    int x3 = (int)p2.x;
-    int y1 = (int)p0.y;
-    int y2 = (int)p1.y;
-    int y3 = (int)p2.y;
-
-    if (y2 < y1)
-    {
-        std::swap(y1, y2);
-        std::swap(x1, x2);
-        std::swap(tex0.u, tex1.u);
-        std::swap(tex0.v, tex1.v);
-        std::swap(tex0.w, tex1.w);
-    }
-
-    if (y3 < y1)
-    {
-        std::swap(y1, y3);
-        std::swap(x1, x3);
-        std::swap(tex0.u, tex2.u);
-        std::swap(tex0.v, tex2.v);
-        std::swap(tex0.w, tex2.w);
-    }
-
-    if (y3 < y2)
-    {
-        std::swap(y2, y3);
-        std::swap(x2, x3);
-        std::swap(tex1.u, tex2.u);
-        std::swap(tex1.v, tex2.v);
-        std::swap(tex1.w, tex2.w);
-    }
-
-    int dy1 = y2 - y1;
-    int dx1 = x2 - x1;
-    float dv1 = tex1.v - tex0.v;
-    float du1 = tex1.u - tex0.u;
-    float dw1 = tex1.w - tex0.w;
-
-    int dy2 = y3 - y1;
-    int dx2 = x3 - x1;
-    float dv2 = tex2.v - tex0.v;
-    float du2 = tex2.u - tex0.u;
-    float dw2 = tex2.w - tex0.w;
-
-    float tex_u, tex_v, tex_w;
-
-    float dax_step = 0, dbx_step = 0,
-          du1_step = 0, dv1_step = 0,
-          du2_step = 0, dv2_step = 0,
-          dw1_step = 0, dw2_step = 0;
-
-    if (dy1) dax_step = dx1 / (float)abs(dy1);
-    if (dy2) dbx_step = dx2 / (float)abs(dy2);
-
-    if (dy1) du1_step = du1 / (float)abs(dy1);
-    if (dy1) dv1_step = dv1 / (float)abs(dy1);
-    if (dy1) dw1_step = dw1 / (float)abs(dy1);
-
-    if (dy2) du2_step = du2 / (float)abs(dy2);
-    if (dy2) dv2_step = dv2 / (float)abs(dy2);
-    if (dy2) dw2_step = dw2 / (float)abs(dy2);
-
-    if (dy1)
-    {
-        for (int i = y1; i <= y2; i++)
-        {
-            int ax = x1 + (float)(i - y1) * dax_step;
-            int bx = x1 + (float)(i - y1) * dbx_step;
-
-            if (ax == bx) continue;
-
-            float tex_su = tex0.u + (float)(i - y1) * du1_step;
-            float tex_sv = tex0.v + (float)(i - y1) * dv1_step;
-            float tex_sw = tex0.w + (float)(i - y1) * dw1_step;
-
-            float tex_eu = tex0.u + (float)(i - y1) * du2_step;
-            float tex_ev = tex0.v + (float)(i - y1) * dv2_step;
-            float tex_ew = tex0.w + (float)(i - y1) * dw2_step;
-
-            if (ax > bx)
-            {
-                std::swap(ax, bx);
-                std::swap(tex_su, tex_eu);
-                std::swap(tex_sv, tex_ev);
-                std::swap(tex_sw, tex_ew);
-            }
-
-            tex_u = tex_su;
-            tex_v = tex_sv;
-            tex_w = tex_sw;
-
-            float tstep = 1.0f / ((float)(bx - ax));
-            float t = 0.0f;
-
-            for (int j = ax; j < bx; j++)
-            {
-                tex_u = (1.0f - t) * tex_su + t * tex_eu;
-                tex_v = (1.0f - t) * tex_sv + t * tex_ev;
-                tex_w = (1.0f - t) * tex_sw + t * tex_ew;
-
-                if (tex_w < depthBuffer[i * _width + j])
-                {
-                    int x = (int)(tex_u / tex_w * texture.width);
-                    int y = (int)(tex_v / tex_w * texture.height);
-
-                    SDL_Color pointColor;
-                    if (texture.isBaseColor)
-                        pointColor = color;
-                    else
-                        pointColor = texture.GetColorAt(x, y);
-                    RenderPoint({(float)j, (float)i}, pointColor);
-
-                    depthBuffer[i * _width + j] = tex_w;
-                }
-                t += tstep;
-            }
-
-        }
-    }
-
-    dy1 = y3 - y2;
-    dx1 = x3 - x2;
-    dv1 = tex2.v - tex1.v;
-    du1 = tex2.u - tex1.u;
-    dw1 = tex2.w - tex1.w;
-
-    if (dy1) dax_step = dx1 / (float)abs(dy1);
-    if (dy2) dbx_step = dx2 / (float)abs(dy2);
-
-    du1_step = 0, dv1_step = 0;
-    if (dy1) du1_step = du1 / (float)abs(dy1);
-    if (dy1) dv1_step = dv1 / (float)abs(dy1);
-    if (dy1) dw1_step = dw1 / (float)abs(dy1);
-
-    if (dy1)
-    {
-        for (int i = y2; i <= y3; i++)
-        {
-            int ax = x2 + (float)(i - y2) * dax_step;
-            int bx = x1 + (float)(i - y1) * dbx_step;
-
-            if (ax == bx) continue;
-
-            float tex_su = tex1.u + (float)(i - y2) * du1_step;
-            float tex_sv = tex1.v + (float)(i - y2) * dv1_step;
-            float tex_sw = tex1.w + (float)(i - y2) * dw1_step;
-
-            float tex_eu = tex0.u + (float)(i - y1) * du2_step;
-            float tex_ev = tex0.v + (float)(i - y1) * dv2_step;
-            float tex_ew = tex0.w + (float)(i - y1) * dw2_step;
-
-            if (ax > bx)
-            {
-                std::swap(ax, bx);
-                std::swap(tex_su, tex_eu);
-                std::swap(tex_sv, tex_ev);
-                std::swap(tex_sw, tex_ew);
-            }
-
-            tex_u = tex_su;
-            tex_v = tex_sv;
-            tex_w = tex_sw;
-
-            float tstep = 1.0f / ((float)(bx - ax));
-            float t = 0.0f;
-
-            for (int j = ax; j < bx; j++)
-            {
-                tex_u = (1.0f - t) * tex_su + t * tex_eu;
-                tex_v = (1.0f - t) * tex_sv + t * tex_ev;
-                tex_w = (1.0f - t) * tex_sw + t * tex_ew;
-
-                if (tex_w < depthBuffer[i * _width + j])
-                {
-                    int x = (int)(tex_u / tex_w * texture.width);
-                    int y = (int)(tex_v / tex_w * texture.height);
-
-                    SDL_Color pointColor;
-                    if (texture.isBaseColor)
-                        pointColor = color;
-                    else
-                        pointColor = texture.GetColorAt(x, y);
-                    RenderPoint({(float)j, (float)i}, pointColor);
+    RasterTriangle tri;
+    tri.p[0] = p0; tri.p[1] = p1; tri.p[2] = p2;
+    tri.t[0] = tex0; tri.t[1] = tex1; tri.t[2] = tex2;
+    tri.color = color;
+    tri.texture = &texture;
+    tri.depthTest = true;
+
+    rasterizer.DrawTriangle(ScreenTarget(), tri);
+}
 
-                    depthBuffer[i * _width + j] = tex_w;
-                }
-                t += tstep;
-            }
-        }
-    }
+// Whole screen as a render target
+RenderTarget Engine3D::ScreenTarget()
+{
+    RenderTarget target;
+    target.color = colorBuffer;
+    target.depth = depthBuffer;
+    target.width = target.maxX = _width;
+    target.height = target.maxY = _height;
+    target.hizBlocks = hizBlocks;
+    target.hizTiles = hizTiles;
+    target.hizBlocksX = hizBlocksX;
+    target.hizBlocksY = hizBlocksY;
+    target.hizTilesX = hizTilesX;
+    return target;
 }
 
 void Engine3D::RenderRect(Vec2 pos, Vec2 size, int thickness, SDL_Color color)
 {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+    Uint32 pixel = PackColor(color);
 
     SDL_Rect rect{(int)pos.x, (int)pos.y, (int)size.x, (int)size.y};
-    if (thickness < 0)
+    if (thickness < 0 || rect.w <= 0 || rect.h <= 0)
         return;
     else if (thickness == 0)
-        SDL_RenderFillRect(renderer, &rect);
+    {
+        for (int y = rect.y; y < rect.y + rect.h; y++)
+            DrawSpan(rect.x, rect.x + rect.w - 1, y, pixel);
+    }
     else if (thickness == 1)
-        SDL_RenderDrawRect(renderer, &rect);
+    {
+        int x1 = rect.x + rect.w - 1;
+        int y1 = rect.y + rect.h - 1;
+        DrawSpan(rect.x, x1, rect.y, pixel);
+        DrawSpan(rect.x, x1, y1, pixel);
+        DrawLine(rect.x, rect.y, rect.x, y1, pixel);
+        DrawLine(x1, rect.y, x1, y1, pixel);
+    }
     else
     {
         // Thickness can't be over half the size of the bigger axis
         thickness = std::min({thickness, (int)std::min({size.x, size.y})});
 
-        // Left
+        // Left and right, as one span per row each
         int i;
-        for (i = 0; i <= thickness; i++)
-        {
-            SDL_RenderDrawLine(renderer, pos.x + i, pos.y, pos.x + i, pos.y + size.y);
-        }
-
-        // Right
-        for (i = 0; i <= thickness; i++)
+        for (int y = pos.y; y <= (int)(pos.y + size.y); y++)
         {
-            SDL_RenderDrawLine(renderer, pos.x + size.x - i, pos.y, pos.x + size.x - i, pos.y + size.y);
+            DrawSpan(pos.x, pos.x + thickness, y, pixel);
+            DrawSpan(pos.x + size.x - thickness, pos.x + size.x, y, pixel);
         }
 
         // Top
         for (i = 0; i <= thickness; i++)
         {
-            SDL_RenderDrawLine(renderer, pos.x, pos.y + i, pos.x + size.x, pos.y + i);
+            DrawSpan(pos.x, pos.x + size.x, pos.y + i, pixel);
         }
 
         // Bottom
         for (i = 0; i <= thickness; i++)
         {
-            SDL_RenderDrawLine(renderer, pos.x, pos.y + size.y - i, pos.x + size.x, pos.y + size.y - i);
+            DrawSpan(pos.x, pos.x + size.x, pos.y + size.y - i, pixel);
         }
     }
 }
\ No newline at end of file
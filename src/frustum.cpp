@@ -0,0 +1,109 @@
+#include <frustum.hpp>
+
+Frustum Frustum::FromProjection(const Mat4 &proj, float near, float far)
+{
+    const float (*m)[4] = proj.m;
+
+    // Visible points get clip w of this sign, the engine's projection makes it
+    // negative. Multiplying by it keeps plane normals pointing inside
+    float sign = near * m[2][3] + m[3][3] < 0.0f ? -1.0f : 1.0f;
+
+    // NDC -1 <= c / w <= 1, as planes w + c and w - c on (x, y, z, 1)
+    auto side = [&](int c, float dir, Plane &plane)
+    {
+        Vec3 n = {
+            sign * (m[0][3] + dir * m[0][c]),
+            sign * (m[1][3] + dir * m[1][c]),
+            sign * (m[2][3] + dir * m[2][c])
+        };
+        float d = sign * (m[3][3] + dir * m[3][c]);
+
+        float length = n.magnitude();
+        plane.n = n / length;
+        plane.d = d / length;
+    };
+
+    Frustum f;
+    side(0, 1.0f, f.planes[0]);       // Left
+    side(0, -1.0f, f.planes[1]);      // Right
+    side(1, 1.0f, f.planes[2]);       // Top
+    side(1, -1.0f, f.planes[3]);      // Bottom
+
+    // View space looks down +z
+    f.planes[4] = {{0.0f, 0.0f, 1.0f}, -near};
+    f.planes[5] = {{0.0f, 0.0f, -1.0f}, far};
+    return f;
+}
+
+Frustum Frustum::Transformed(const Mat4 &m)
+{
+    // n.(m * p) + d, regrouped as a plane on p
+    Frustum f;
+    for (int i = 0; i < 6; i++)
+    {
+        Vec3 n = planes[i].n;
+        f.planes[i].n = {
+            n.x * m.m[0][0] + n.y * m.m[0][1] + n.z * m.m[0][2],
+            n.x * m.m[1][0] + n.y * m.m[1][1] + n.z * m.m[1][2],
+            n.x * m.m[2][0] + n.y * m.m[2][1] + n.z * m.m[2][2]
+        };
+        f.planes[i].d = n.x * m.m[3][0] + n.y * m.m[3][1] + n.z * m.m[3][2] + planes[i].d;
+    }
+
+    return f;
+}
+
+FrustumTest Frustum::TestSphere(Vec3 center, float radius)
+{
+    FrustumTest result = FrustumTest::Inside;
+    for (auto &plane : planes)
+    {
+        float distance = plane.n.dot(center) + plane.d;
+        if (distance < -radius)
+            return FrustumTest::Outside;
+        if (distance < radius)
+            result = FrustumTest::Intersects;
+    }
+
+    return result;
+}
+
+FrustumTest Frustum::TestPoints(const Vec3 *points, int count)
+{
+    FrustumTest result = FrustumTest::Inside;
+    for (auto &plane : planes)
+    {
+        int inside = 0;
+        for (int i = 0; i < count; i++)
+        {
+            Vec3 p = points[i];
+            if (plane.n.dot(p) + plane.d >= 0.0f)
+                inside++;
+        }
+
+        if (inside == 0)
+            return FrustumTest::Outside;
+        if (inside < count)
+            result = FrustumTest::Intersects;
+    }
+
+    return result;
+}
+
+FrustumTest Frustum::TestBox(Vec3 min, Vec3 max)
+{
+    FrustumTest result = FrustumTest::Inside;
+    for (auto &plane : planes)
+    {
+        // Corners farthest along the normal and farthest against it
+        Vec3 far = {plane.n.x >= 0.0f ? max.x : min.x, plane.n.y >= 0.0f ? max.y : min.y, plane.n.z >= 0.0f ? max.z : min.z};
+        Vec3 near = {plane.n.x >= 0.0f ? min.x : max.x, plane.n.y >= 0.0f ? min.y : max.y, plane.n.z >= 0.0f ? min.z : max.z};
+
+        if (plane.n.dot(far) + plane.d < 0.0f)
+            return FrustumTest::Outside;
+        if (plane.n.dot(near) + plane.d < 0.0f)
+            result = FrustumTest::Intersects;
+    }
+
+    return result;
+}
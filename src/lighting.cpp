@@ -0,0 +1,29 @@
+#include <cmath>
+
+#include <lighting.hpp>
+
+float srgbToLinear[256];
+Uint8 linearToSRGB[LINEAR_STEPS + 1];
+
+// sRGB transfer curve, both directions
+static float ToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float ToSRGB(float c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// Fill the tables before main
+static struct LightingTables
+{
+    LightingTables()
+    {
+        for (int i = 0; i < 256; i++)
+            srgbToLinear[i] = ToLinear(i / 255.0f);
+        for (int i = 0; i <= LINEAR_STEPS; i++)
+            linearToSRGB[i] = (Uint8)(ToSRGB((float)i / LINEAR_STEPS) * 255.0f + 0.5f);
+    }
+} lightingTables;
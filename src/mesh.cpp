@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <tuple>
+
 #include <mesh.hpp>
+#include <simplify.hpp>
 
 float map(float n, float start1, float stop1, float start2, float stop2)
 {
@@ -15,13 +21,205 @@ Mesh::~Mesh()
 
 }
 
-// Set color of all triangles
+// Rotation around z, y then x, then the translation to position
+Mat4 Mesh::WorldMatrix()
+{
+    Mat4 matRotZ = Mat4::AxisAngle({0.0f, 0.0f, 1.0f}, rotation.z);
+    Mat4 matRotY = Mat4::AxisAngle({0.0f, 1.0f, 0.0f}, rotation.y);
+    Mat4 matRotX = Mat4::AxisAngle({1.0f, 0.0f, 0.0f}, rotation.x);
+
+    Mat4 matTrans = Mat4::Translation(position);
+    return Mat4::Identity() * matRotZ * matRotY * matRotX * matTrans;
+}
+
 void Mesh::SetColor(SDL_Color color)
 {
     for (auto& tri : tris)
     {
         tri.color = color;
     }
+
+    std::fill(colors.begin(), colors.end(), color);
+    for (auto &lod : lods)
+        std::fill(lod.colors.begin(), lod.colors.end(), color);
+}
+
+void Mesh::AddTriangle(int p0, int p1, int p2, int t0, int t1, int t2, SDL_Color color)
+{
+    indices.insert(indices.end(), {p0, p1, p2});
+    uvIndices.insert(uvIndices.end(), {t0, t1, t2});
+    colors.push_back(color);
+}
+
+void Mesh::BuildIndices()
+{
+    // Lookup of values already in the arrays
+    std::map<std::tuple<float, float, float>, int> positionIndex;
+    std::map<std::tuple<float, float, float>, int> uvIndex;
+    for (int i = 0; i < (int)positions.size(); i++)
+        positionIndex.insert({{positions[i].x, positions[i].y, positions[i].z}, i});
+    for (int i = 0; i < (int)uvs.size(); i++)
+        uvIndex.insert({{uvs[i].u, uvs[i].v, uvs[i].w}, i});
+
+    auto position = [&](Vec3 &p)
+    {
+        auto inserted = positionIndex.insert({{p.x, p.y, p.z}, (int)positions.size()});
+        if (inserted.second) positions.push_back(p);
+        return inserted.first->second;
+    };
+    auto uv = [&](TexUV &t)
+    {
+        auto inserted = uvIndex.insert({{t.u, t.v, t.w}, (int)uvs.size()});
+        if (inserted.second) uvs.push_back(t);
+        return inserted.first->second;
+    };
+
+    for (auto &tri : tris)
+    {
+        int p0 = position(tri.p[0]), p1 = position(tri.p[1]), p2 = position(tri.p[2]);
+        int t0 = uv(tri.t[0]), t1 = uv(tri.t[1]), t2 = uv(tri.t[2]);
+        AddTriangle(p0, p1, p2, t0, t1, t2, tri.color);
+    }
+
+    tris.clear();
+    tris.shrink_to_fit();
+
+    ComputeBounds();
+}
+
+void Mesh::ComputeVertexNormals()
+{
+    // Each corner gets the unit sum of the faces around its position that
+    // bend less than CREASE_ANGLE away from its own face. Cross products are
+    // as long as twice the face area, so big faces weigh more. Corners that
+    // end up with the same normal at a position share it
+    float minCos = std::cos(CREASE_ANGLE * M_PIf / 180.0f);
+    auto smooth = [minCos](const std::vector<Vec3> &points, const std::vector<int> &corners,
+                           std::vector<Vec3> &out, std::vector<int> &outIndices)
+    {
+        int faceCount = (int)corners.size() / 3;
+        std::vector<Vec3> faceNormals(faceCount), faceUnits(faceCount);
+        std::vector<std::vector<int>> facesAt(points.size());
+        for (int f = 0; f < faceCount; f++)
+        {
+            Vec3 p0 = points[corners[3 * f]], p1 = points[corners[3 * f + 1]], p2 = points[corners[3 * f + 2]];
+            faceNormals[f] = (p1 - p0).cross(p2 - p0);
+            faceUnits[f] = faceNormals[f].magnitude() > 0.0f ? faceNormals[f].unit() : Vec3(0.0f, 0.0f, 0.0f);
+            for (int k = 0; k < 3; k++)
+                facesAt[corners[3 * f + k]].push_back(f);
+        }
+
+        // Normals made so far at each position
+        std::vector<std::vector<int>> madeAt(points.size());
+        outIndices.resize(corners.size());
+        for (int f = 0; f < faceCount; f++)
+            for (int k = 0; k < 3; k++)
+            {
+                // Degenerate faces have no direction, they take every face around
+                int position = corners[3 * f + k];
+                bool flat = faceUnits[f].magnitude() == 0.0f;
+                Vec3 sum(0.0f, 0.0f, 0.0f);
+                for (int g : facesAt[position])
+                    if (flat || faceUnits[f].dot(faceUnits[g]) >= minCos)
+                        sum += faceNormals[g];
+                if (sum.magnitude() > 0.0f)
+                    sum = sum.unit();
+
+                int index = -1;
+                for (int made : madeAt[position])
+                    if (out[made].x == sum.x && out[made].y == sum.y && out[made].z == sum.z)
+                        index = made;
+                if (index < 0)
+                {
+                    index = (int)out.size();
+                    out.push_back(sum);
+                    madeAt[position].push_back(index);
+                }
+                outIndices[3 * f + k] = index;
+            }
+    };
+
+    vertexNormals.clear();
+    smooth(positions, indices, vertexNormals, normalIndices);
+
+    // Levels have positions of their own, their normals go after the mesh's
+    for (auto &lod : lods)
+        smooth(lod.positions, lod.indices, vertexNormals, lod.normalIndices);
+}
+
+void Mesh::ComputeBounds()
+{
+    if (positions.empty())
+    {
+        boundsMin = boundsMax = boundsCenter = {0.0f, 0.0f, 0.0f};
+        boundsRadius = 0.0f;
+        return;
+    }
+
+    boundsMin = boundsMax = positions[0];
+    for (auto &p : positions)
+    {
+        boundsMin = {std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z)};
+        boundsMax = {std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z)};
+    }
+
+    boundsCenter = (boundsMin + boundsMax) * 0.5f;
+    boundsRadius = 0.0f;
+    for (auto &p : positions)
+        boundsRadius = std::max(boundsRadius, Vec3::distance(p, boundsCenter));
+}
+
+// Smallest range of normals holding every index
+static void NormalRange(const std::vector<int> &normalIndices, int &begin, int &end)
+{
+    begin = end = 0;
+    if (normalIndices.empty())
+        return;
+
+    auto range = std::minmax_element(normalIndices.begin(), normalIndices.end());
+    begin = *range.first;
+    end = *range.second + 1;
+}
+
+void Mesh::BuildLODs(int count)
+{
+    std::vector<int> targets;
+    for (int target = TriangleCount() / 2; target >= LOD_MIN_TRIANGLES && (int)targets.size() < count; target /= 2)
+        targets.push_back(target);
+
+    lods = SimplifyMesh(*this, targets);
+    lodLevel = 0;
+    for (auto &lod : lods)
+    {
+        ::BuildClusters(lod.positions, lod.indices, lod.uvIndices, lod.normalIndices, lod.colors, lod.normals, lod.clusters);
+        NormalRange(lod.normalIndices, lod.normalBegin, lod.normalEnd);
+    }
+}
+
+void Mesh::BuildClusters()
+{
+    ::BuildClusters(positions, indices, uvIndices, normalIndices, colors, normals, clusters);
+    NormalRange(normalIndices, normalBegin, normalEnd);
+    for (auto &lod : lods)
+    {
+        ::BuildClusters(lod.positions, lod.indices, lod.uvIndices, lod.normalIndices, lod.colors, lod.normals, lod.clusters);
+        NormalRange(lod.normalIndices, lod.normalBegin, lod.normalEnd);
+    }
+}
+
+int Mesh::SelectLOD(float unitPixels, float maxError)
+{
+    if (maxError <= 0.0f || lods.empty())
+        return lodLevel = 0;
+    lodLevel = std::min(lodLevel, (int)lods.size());
+
+    // Finer once the current level's error shows too much, coarser only
+    // when the next level is within the limit
+    while (lodLevel > 0 && lods[lodLevel - 1].error * unitPixels > maxError * LOD_HYSTERESIS)
+        lodLevel--;
+    while (lodLevel < (int)lods.size() && lods[lodLevel].error * unitPixels <= maxError)
+        lodLevel++;
+    return lodLevel;
 }
 
 // Load from .obj file
@@ -36,13 +234,13 @@ Mesh Mesh::FromOBJFile(std::string fileName)
 
     Mesh mesh;
 
-    // Check if file has UVs and normals
-    bool hasTexture = false;
-    bool hasNormals = false;
+    // Positions, UVs and normals are stored as read, faces index them
+    std::vector<Vec3> &verts = mesh.positions;
+    std::vector<TexUV> &texs = mesh.uvs;
+    std::vector<Vec3> &norms = mesh.vertexNormals;
 
-    // Local cache of verts
-    std::vector<Vec3> verts;
-    std::vector<TexUV> texs;
+    // Corners without a normal mean the file's normals can't be used
+    bool allNormals = true;
 
     while (!f.eof())
     {
@@ -58,9 +256,6 @@ Mesh Mesh::FromOBJFile(std::string fileName)
         {
             if (line[1] == 't')
             {
-                // File has texture
-                hasTexture = true;
-
                 TexUV tex;
                 s >> junk >> junk >> tex.u >> tex.v;
 
@@ -71,10 +266,9 @@ Mesh Mesh::FromOBJFile(std::string fileName)
             }
             else if (line[1] == 'n')
             {
-                // File has normals
-                hasNormals = true;
-
-                // Store in vector
+                Vec3 norm;
+                s >> junk >> junk >> norm.x >> norm.y >> norm.z;
+                norms.push_back(norm.magnitude() > 0.0f ? norm.unit() : norm);
             }
             else
             {
@@ -86,36 +280,59 @@ Mesh Mesh::FromOBJFile(std::string fileName)
 
         if (line[0] == 'f')
         {
-            if (!hasTexture)
+            // Corners as v, v/vt, v//vn or v/vt/vn, counted from 1. Missing
+            // ones are left -1 for now
+            s >> junk;
+            int corner[3][3];
+            for (int k = 0; k < 3; k++)
             {
-                int f[3];
-                s >> junk >> f[0] >> f[1] >> f[2];
-                mesh.tris.push_back({ verts[f[0] - 1], verts[f[1] - 1], verts[f[2] - 1] });
-            }
-            else
-            {
-                s >> junk;
-
-                std::string tokens[6];
-                int nTokenCount = -1;
+                std::string token;
+                s >> token;
 
-                while (!s.eof())
+                int value[3] = {0, 0, 0};
+                int part = 0;
+                for (char c : token)
                 {
-                    char c = s.get();
-                    if (c == ' ' || c == '/')
-                        nTokenCount++;
-                    else
-                        tokens[nTokenCount].append(1, c);
+                    if (c == '/')
+                        part++;
+                    else if (part < 3 && c >= '0' && c <= '9')
+                        value[part] = value[part] * 10 + (c - '0');
                 }
-                tokens[nTokenCount].pop_back();
+                for (int i = 0; i < 3; i++)
+                    corner[k][i] = value[i] - 1;
+            }
 
-                mesh.tris.push_back({
-                    verts[stoi(tokens[0]) - 1], verts[stoi(tokens[2]) - 1], verts[stoi(tokens[4]) - 1],     // Verts
-                    texs[stoi(tokens[1]) - 1], texs[stoi(tokens[3]) - 1], texs[stoi(tokens[5]) - 1]         // UVs
-                });
+            mesh.AddTriangle(
+                corner[0][0], corner[1][0], corner[2][0],     // Verts
+                corner[0][1], corner[1][1], corner[2][1]      // UVs
+            );
+            for (int k = 0; k < 3; k++)
+            {
+                mesh.normalIndices.push_back(corner[k][2]);
+                allNormals = allNormals && corner[k][2] >= 0;
             }
         }
     }
+
+    // Corners without UVs use a default one
+    int defaultUV = -1;
+    for (int &uv : mesh.uvIndices)
+        if (uv < 0)
+        {
+            if (defaultUV < 0)
+            {
+                defaultUV = (int)texs.size();
+                texs.push_back(TexUV());
+            }
+            uv = defaultUV;
+        }
+
+    // No normals in the file, smooth them from the faces
+    if (!allNormals || norms.empty())
+        mesh.ComputeVertexNormals();
+
+    mesh.ComputeBounds();
+    mesh.BuildLODs();
     return mesh;
 }
 
@@ -148,6 +365,7 @@ Mesh Mesh::Cube()
         { Vec3(-0.5f, -0.5f,  0.5f),    Vec3(-0.5f, -0.5f, -0.5f),   Vec3( 0.5f, -0.5f, -0.5f),    TexUV(1.0f, 1.0f),     TexUV(1.0f, 0.0f),     TexUV(0.0f, 0.0f) },
         { Vec3(-0.5f, -0.5f,  0.5f),    Vec3( 0.5f, -0.5f, -0.5f),   Vec3( 0.5f, -0.5f,  0.5f),    TexUV(1.0f, 1.0f),     TexUV(0.0f, 0.0f),     TexUV(0.0f, 1.0f) },
     };
+    mesh.BuildIndices();
 
     return mesh;
 }
@@ -181,6 +399,7 @@ Mesh Mesh::MinecraftCube()
         { Vec3(-0.5f, -0.5f,  0.5f),    Vec3(-0.5f, -0.5f, -0.5f),   Vec3( 0.5f, -0.5f, -0.5f),    TexUV(0.5f,        1.0f),      TexUV(0.5f,  2.0f / 3.0f),     TexUV(0.25f, 2.0f / 3.0f) },
         { Vec3(-0.5f, -0.5f,  0.5f),    Vec3( 0.5f, -0.5f, -0.5f),   Vec3( 0.5f, -0.5f,  0.5f),    TexUV(0.5f,        1.0f),      TexUV(0.25f, 2.0f / 3.0f),     TexUV(0.25f,        1.0f) },
     };
+    mesh.BuildIndices();
 
     return mesh;
 }
@@ -189,8 +408,9 @@ Mesh Mesh::Sphere(float radius, int resolution)
 {
     Mesh mesh;
 
-    // Cache of vertices
-    std::vector<Vec3> vertices;
+    // Vertices, and the four UV corners shared by every quad
+    std::vector<Vec3> &vertices = mesh.positions;
+    mesh.uvs = {TexUV{0.0f, 1.0f, 1.0f}, TexUV{0.0f, 0.0f, 1.0f}, TexUV{1.0f, 0.0f, 1.0f}, TexUV{1.0f, 1.0f, 1.0f}};
 
     // Create vertices
     for (int i = 0; i < resolution; i++)
@@ -221,25 +441,12 @@ Mesh Mesh::Sphere(float radius, int resolution)
             int i3 = (i+1) + (j+1) * resolution;
 
             // Create two triangles
-            mesh.tris.push_back({
-                vertices[i0],
-                vertices[i1],
-                vertices[i3],
-                TexUV{0.0f, 1.0f, 1.0f},
-                TexUV{0.0f, 0.0f, 1.0f},
-                TexUV{1.0f, 0.0f, 1.0f}
-            });
-            mesh.tris.push_back({
-                vertices[i0],
-                vertices[i3],
-                vertices[i2],
-                TexUV{0.0f, 1.0f, 1.0f},
-                TexUV{1.0f, 0.0f, 1.0f},
-                TexUV{1.0f, 1.0f, 1.0f}
-            });
+            mesh.AddTriangle(i0, i1, i3, 0, 1, 2);
+            mesh.AddTriangle(i0, i3, i2, 0, 2, 3);
         }
     }
 
+    mesh.ComputeBounds();
     return mesh;
 }
 
@@ -247,8 +454,9 @@ Mesh Mesh::Cone(float baseRadius, float height, int resolution)
 {
     Mesh mesh;
     
-    // Cache of vertices
-    std::vector<Vec3> vertices;
+    // Vertices, base ring first
+    std::vector<Vec3> &vertices = mesh.positions;
+    mesh.uvs = {TexUV(0.0f, 0.0f), TexUV(0.0f, 1.0f), TexUV(1.0f, 1.0f), TexUV(1.0f, 0.0f)};
 
     // Base vertices
     for (float i = 0; i < resolution; i++)
@@ -260,25 +468,18 @@ Mesh Mesh::Cone(float baseRadius, float height, int resolution)
     }
 
     // Create top faces
-    Vec3 topVertex = {0.0f, height * .5f, 0.0f};
+    int topVertex = (int)vertices.size();
+    vertices.push_back({0.0f, height * .5f, 0.0f});
     for (int i = 0; i < resolution; i++)
-    {
-        mesh.tris.push_back({
-            vertices[i], topVertex, vertices[(i+1) % resolution],
-            TexUV(0.0f, 0.0f), TexUV(0.0f, 1.0f), TexUV(1.0f, 1.0f)
-        });
-    }
+        mesh.AddTriangle(i, topVertex, (i+1) % resolution, 0, 1, 2);
 
     // Create bottom faces
-    Vec3 bottomVertex = {0.0f, -height * .5f, 0.0f};
+    int bottomVertex = (int)vertices.size();
+    vertices.push_back({0.0f, -height * .5f, 0.0f});
     for (int i = 0; i < resolution; i++)
-    {
-        mesh.tris.push_back({
-            vertices[i], vertices[(i+1) % resolution], bottomVertex,
-            TexUV(1.0f, 0.0f), TexUV(0.0f, 0.0f), TexUV(1.0f, 1.0f)
-        });
-    }
+        mesh.AddTriangle(i, (i+1) % resolution, bottomVertex, 3, 0, 2);
 
+    mesh.ComputeBounds();
     return mesh;
 }
 
@@ -286,9 +487,9 @@ Mesh Mesh::Cylinder(float baseRadius, float height, int resolution)
 {
     Mesh mesh;
     
-    // Cache of vertices
-    std::vector<Vec3> topVertices;
-    std::vector<Vec3> bottomVertices;
+    // Vertices: bottom ring, top ring, bottom center, top center
+    std::vector<Vec3> &vertices = mesh.positions;
+    mesh.uvs = {TexUV(1.0f, 0.0f), TexUV(0.0f, 0.0f), TexUV(1.0f, 1.0f)};
 
     // Base vertices
     for (float i = 0; i < resolution; i++)
@@ -296,7 +497,7 @@ Mesh Mesh::Cylinder(float baseRadius, float height, int resolution)
         float x = std::cos(i / (float)resolution * M_PI * 2) * baseRadius;
         float z = std::sin(i / (float)resolution * M_PI * 2) * baseRadius;
 
-        bottomVertices.push_back({x, -height * .5f, z});
+        vertices.push_back({x, -height * .5f, z});
     }
 
     // Top vertices
@@ -305,42 +506,36 @@ Mesh Mesh::Cylinder(float baseRadius, float height, int resolution)
         float x = std::cos(i / (float)resolution * M_PI * 2) * baseRadius;
         float z = std::sin(i / (float)resolution * M_PI * 2) * baseRadius;
 
-        topVertices.push_back({x, height * .5f, z});
+        vertices.push_back({x, height * .5f, z});
     }
 
+    auto bottom = [&](int i) { return i % resolution; };
+    auto top = [&](int i) { return resolution + i % resolution; };
+
     // Create side faces
     for (int i = 0; i < resolution; i++)
     {
         // First
-        mesh.tris.push_back({
-            topVertices[(i+1) % resolution], bottomVertices[(i+1) % resolution], bottomVertices[i],
-            TexUV(1.0f, 0.0f), TexUV(0.0f, 0.0f), TexUV(1.0f, 1.0f)
-        });
+        mesh.AddTriangle(top(i+1), bottom(i+1), bottom(i), 0, 1, 2);
 
         // Second
-        mesh.tris.push_back({
-            topVertices[i], topVertices[(i+1) % resolution], bottomVertices[i],
-            TexUV(1.0f, 0.0f), TexUV(0.0f, 0.0f), TexUV(1.0f, 1.0f)
-        });
+        mesh.AddTriangle(top(i), top(i+1), bottom(i), 0, 1, 2);
     }
 
     // Create top and bottom faces
-    Vec3 bottomVertex = {0.0f, -height * .5f, 0.0f};
-    Vec3 topVertex = {0.0f, height * .5f, 0.0f};
+    int bottomVertex = (int)vertices.size();
+    vertices.push_back({0.0f, -height * .5f, 0.0f});
+    int topVertex = (int)vertices.size();
+    vertices.push_back({0.0f, height * .5f, 0.0f});
     for (int i = 0; i < resolution; i++)
     {
         // Top
-        mesh.tris.push_back({
-            topVertices[(i+1) % resolution], topVertices[i], topVertex,
-            TexUV(1.0f, 0.0f), TexUV(0.0f, 0.0f), TexUV(1.0f, 1.0f)
-        });
+        mesh.AddTriangle(top(i+1), top(i), topVertex, 0, 1, 2);
 
         // Second
-        mesh.tris.push_back({
-            bottomVertices[i], bottomVertices[(i+1) % resolution], bottomVertex,
-            TexUV(1.0f, 0.0f), TexUV(0.0f, 0.0f), TexUV(1.0f, 1.0f)
-        });
+        mesh.AddTriangle(bottom(i), bottom(i+1), bottomVertex, 0, 1, 2);
     }
 
+    mesh.ComputeBounds();
     return mesh;
 }
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include <radix_sort.hpp>
+
+void RadixSort(std::vector<SortItem> &items, std::vector<SortItem> &scratch)
+{
+    int count = (int)items.size();
+    if (count < 2) return;
+    scratch.resize(count);
+
+    // Histogram of all four bytes in one go
+    int histogram[4][256] = {};
+    for (const SortItem &item : items)
+        for (int pass = 0; pass < 4; pass++)
+            histogram[pass][(item.key >> (pass * 8)) & 0xFF]++;
+
+    for (int pass = 0; pass < 4; pass++)
+    {
+        int *h = histogram[pass];
+
+        // Every key has the same byte, nothing moves
+        if (h[(items[0].key >> (pass * 8)) & 0xFF] == count) continue;
+
+        // Counts to starting offsets
+        int offset = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            int n = h[i];
+            h[i] = offset;
+            offset += n;
+        }
+
+        for (const SortItem &item : items)
+            scratch[h[(item.key >> (pass * 8)) & 0xFF]++] = item;
+        items.swap(scratch);
+    }
+}
@@ -0,0 +1,410 @@
+#include <cmath>
+#include <algorithm>
+
+#include <color.hpp>
+#include <raster_kernel.hpp>
+
+void RasterizeScalar(const RenderTarget &target, const TriangleSetup &s)
+{
+    RasterizeLanes<LanesScalar>(target, s);
+}
+
+void RasterizeSSE2(const RenderTarget &target, const TriangleSetup &s)
+{
+#if defined(__SSE2__)
+    // Lanes step edges in 32 bits, large triangles take the 64-bit path
+    if (s.narrowEdges)
+        RasterizeLanes<LanesSSE2>(target, s);
+    else
+        RasterizeLanes<LanesScalar>(target, s);
+#else
+    RasterizeLanes<LanesScalar>(target, s);
+#endif
+}
+
+// Wrapped or clamped fetch, for one texel layout
+template <TextureLayout layout>
+static void FetchLayout(const TextureView &t, const int *x, const int *y, int mask, int count, Uint32 *out)
+{
+    if (t.sampler.wrap == TextureWrap::Clamp)
+    {
+        for (int i = 0; i < count; i++)
+            if (mask & (1 << i))
+            {
+                int tx = std::min(std::max(x[i], 0), t.width - 1);
+                int ty = std::min(std::max(y[i], 0), t.height - 1);
+                out[i] = t.texels[TexelIndex<layout>(t, tx, ty)];
+            }
+        return;
+    }
+
+    // Loaded levels are powers of two and the mask wraps them, bilinear taps
+    // left of and above the image too. Any other size takes a real modulo
+    if (t.width == t.widthMask + 1 && t.height == t.heightMask + 1)
+    {
+        for (int i = 0; i < count; i++)
+            if (mask & (1 << i))
+                out[i] = t.texels[TexelIndex<layout>(t, x[i] & t.widthMask, y[i] & t.heightMask)];
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        if (mask & (1 << i))
+        {
+            int tx = x[i] % t.width, ty = y[i] % t.height;
+            if (tx < 0) tx += t.width;
+            if (ty < 0) ty += t.height;
+            out[i] = t.texels[TexelIndex<layout>(t, tx, ty)];
+        }
+}
+
+void FetchTexels(const TriangleSetup &s, const int *x, const int *y, int mask, int count, Uint32 *out)
+{
+    switch (s.texture.layout)
+    {
+        case TextureLayout::Tiled:
+            FetchLayout<TextureLayout::Tiled>(s.texture, x, y, mask, count, out);
+            break;
+        case TextureLayout::Morton:
+            FetchLayout<TextureLayout::Morton>(s.texture, x, y, mask, count, out);
+            break;
+        default:
+            FetchLayout<TextureLayout::Linear>(s.texture, x, y, mask, count, out);
+            break;
+    }
+}
+
+void FetchQuads(const TriangleSetup &s, const int *x, const int *y, int mask, int count,
+                Uint32 *topLeft, Uint32 *topRight, Uint32 *bottomLeft, Uint32 *bottomRight, int *weightX, int *weightY)
+{
+    // Lanes of the widest path
+    int left[8], right[8], top[8], bottom[8];
+    for (int i = 0; i < count; i++)
+    {
+        left[i] = (x[i] >> 8) - BILINEAR_OFFSET;
+        top[i] = (y[i] >> 8) - BILINEAR_OFFSET;
+        right[i] = left[i] + 1;
+        bottom[i] = top[i] + 1;
+        bool inside = mask & (1 << i);
+        weightX[i] = inside ? x[i] & 0xFF : 0;
+        weightY[i] = inside ? y[i] & 0xFF : 0;
+        topLeft[i] = topRight[i] = bottomLeft[i] = bottomRight[i] = 0;
+    }
+
+    FetchTexels(s, left, top, mask, count, topLeft);
+    FetchTexels(s, right, top, mask, count, topRight);
+    FetchTexels(s, left, bottom, mask, count, bottomLeft);
+    FetchTexels(s, right, bottom, mask, count, bottomRight);
+}
+
+void BlendColors(const int *r, const int *g, const int *b, int mask, int count, Uint32 *out)
+{
+    auto clamp = [](int c) { return c < 0 ? 0 : (c > 255 ? 255 : c); };
+    for (int i = 0; i < count; i++)
+        if (mask & (1 << i))
+            out[i] = 0xFF000000u | (Uint32)clamp(r[i]) << 16 | (Uint32)clamp(g[i]) << 8 | (Uint32)clamp(b[i]);
+}
+
+void RowCoverage(const TriangleSetup &s, int y, int &x0, int &x1)
+{
+    x0 = s.minX;
+    x1 = s.maxX;
+
+    long long centerY = (long long)y * SUBPIXEL_STEPS + SUBPIXEL_STEPS / 2;
+    for (int i = 0; i < 3 && x0 <= x1; i++)
+    {
+        // E(x) = step * x + e0 at the center of pixel x
+        long long step = s.fixA[i] * SUBPIXEL_STEPS;
+        long long e0 = s.fixA[i] * (SUBPIXEL_STEPS / 2) + s.fixB[i] * centerY + s.fixC[i];
+        if (step == 0)
+        {
+            if (e0 < 0) x1 = x0 - 1;
+            continue;
+        }
+
+        // Estimate where the edge crosses the row, then settle it exactly
+        double cross = -(double)e0 / (double)step;
+        if (step > 0)
+        {
+            // Inside from the crossing on
+            if (cross <= x0) continue;
+            if (cross > x1 + 1) { x1 = x0 - 1; continue; }
+            int x = (int)std::ceil(cross);
+            while (x <= x1 && step * x + e0 < 0) x++;
+            while (x > x0 && step * (x - 1) + e0 >= 0) x--;
+            x0 = x;
+        }
+        else
+        {
+            // Inside up to the crossing
+            if (cross >= x1) continue;
+            if (cross < x0 - 1) { x1 = x0 - 1; continue; }
+            int x = (int)std::floor(cross);
+            while (x >= x0 && step * x + e0 < 0) x--;
+            while (x < x1 && step * (x + 1) + e0 >= 0) x++;
+            x1 = x;
+        }
+    }
+}
+
+Rasterizer::Rasterizer()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (SDL_HasAVX2())
+        path = RasterPath::AVX2;
+    else if (SDL_HasSSE2())
+        path = RasterPath::SSE2;
+#endif
+}
+
+void Rasterizer::DrawTriangle(const RenderTarget &target, const RasterTriangle &tri)
+{
+    TriangleSetup s;
+    if (SetupTriangle(target, tri, s))
+        DrawSetup(target, s);
+}
+
+// Floor of a / b for b > 0
+static long long FloorDiv(long long a, long long b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+bool Rasterizer::SetupTriangle(const RenderTarget &target, const RasterTriangle &tri, TriangleSetup &s)
+{
+    TexUV t[3] = {tri.t[0], tri.t[1], tri.t[2]};
+    SDL_Color colors[3] = {tri.colors[0], tri.colors[1], tri.colors[2]};
+
+    // Snap to 28.4 fixed point, vertices too far out to snap are dropped
+    long long X[3], Y[3];
+    for (int i = 0; i < 3; i++)
+    {
+        if (!(std::abs(tri.p[i].x) < SUBPIXEL_LIMIT && std::abs(tri.p[i].y) < SUBPIXEL_LIMIT))
+            return false;
+        X[i] = std::llround(tri.p[i].x * SUBPIXEL_STEPS);
+        Y[i] = std::llround(tri.p[i].y * SUBPIXEL_STEPS);
+    }
+
+    // Twice the signed area, make winding positive so inside means E >= 0
+    long long area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+    if (area == 0) return false;
+    if (area < 0)
+    {
+        std::swap(X[1], X[2]);
+        std::swap(Y[1], Y[2]);
+        std::swap(t[1], t[2]);
+        std::swap(colors[1], colors[2]);
+        area = -area;
+    }
+
+    // Bounding box of covered pixel centers, clipped to target
+    long long minX = std::min({X[0], X[1], X[2]});
+    long long maxX = std::max({X[0], X[1], X[2]});
+    long long minY = std::min({Y[0], Y[1], Y[2]});
+    long long maxY = std::max({Y[0], Y[1], Y[2]});
+    const long long half = SUBPIXEL_STEPS / 2;
+    s.minX = (int)std::max((long long)target.minX, FloorDiv(minX - half + SUBPIXEL_STEPS - 1, SUBPIXEL_STEPS));
+    s.maxX = (int)std::min((long long)target.maxX - 1, FloorDiv(maxX - half, SUBPIXEL_STEPS));
+    s.minY = (int)std::max((long long)target.minY, FloorDiv(minY - half + SUBPIXEL_STEPS - 1, SUBPIXEL_STEPS));
+    s.maxY = (int)std::min((long long)target.maxY - 1, FloorDiv(maxY - half, SUBPIXEL_STEPS));
+    if (s.minX > s.maxX || s.minY > s.maxY) return false;
+
+    // Every pixel center of the box is inside the vertex bounds, where
+    // |E| <= 2 * width * height, so edges fit in 32 bits below 2^15 steps
+    s.narrowEdges = maxX - minX < (1 << 15) && maxY - minY < (1 << 15);
+
+    // Snapped positions, attributes are interpolated over these
+    Vec2 p[3];
+    for (int i = 0; i < 3; i++)
+        p[i] = {(float)X[i] / SUBPIXEL_STEPS, (float)Y[i] / SUBPIXEL_STEPS};
+
+    // Edge i is opposite to vertex i
+    for (int i = 0; i < 3; i++)
+    {
+        int a = (i + 1) % 3;
+        int b = (i + 2) % 3;
+        s.fixA[i] = Y[a] - Y[b];
+        s.fixB[i] = X[b] - X[a];
+        s.fixC[i] = X[a] * Y[b] - Y[a] * X[b];
+
+        // Top-left rule: pixel centers exactly on an edge belong to the
+        // triangle only if it is a left edge or a top edge
+        bool topLeft = s.fixA[i] > 0 || (s.fixA[i] == 0 && s.fixB[i] > 0);
+        if (!topLeft) s.fixC[i]--;
+
+        s.edgeA[i] = p[a].y - p[b].y;
+        s.edgeB[i] = p[b].x - p[a].x;
+        s.edgeC[i] = p[a].x * p[b].y - p[a].y * p[b].x;
+    }
+
+    // Attribute planes from barycentric weights
+    float areaPixels = (float)area / (SUBPIXEL_STEPS * SUBPIXEL_STEPS);
+    auto plane = [&](float a0, float a1, float a2)
+    {
+        TriangleSetup::Plane pl;
+        pl.dx = (s.edgeA[0] * a0 + s.edgeA[1] * a1 + s.edgeA[2] * a2) / areaPixels;
+        pl.dy = (s.edgeB[0] * a0 + s.edgeB[1] * a1 + s.edgeB[2] * a2) / areaPixels;
+        pl.c = a0 - pl.dx * p[0].x - pl.dy * p[0].y;
+        return pl;
+    };
+    s.z = plane(t[0].w, t[1].w, t[2].w);
+    s.u = plane(t[0].u, t[1].u, t[2].u);
+    s.v = plane(t[0].v, t[1].v, t[2].v);
+
+    // Bounds used by the depth pyramid must never be above a depth the
+    // inner loop computes, so leave room for float rounding
+    s.zEpsilon = (std::abs(s.z.c) + std::abs(s.z.dx) * (s.maxX + 1) + std::abs(s.z.dy) * (s.maxY + 1)) * 1e-6f;
+    s.zMin = std::min({t[0].w, t[1].w, t[2].w}) - s.zEpsilon;
+
+    s.depthTest = tri.depthTest;
+    s.depthWrite = tri.depthWrite;
+    s.color = PackColor(tri.color);
+    s.smooth = tri.smooth;
+    if (s.smooth)
+    {
+        s.r = plane(colors[0].r, colors[1].r, colors[2].r);
+        s.g = plane(colors[0].g, colors[1].g, colors[2].g);
+        s.b = plane(colors[0].b, colors[1].b, colors[2].b);
+        s.r.c += 0.5f;
+        s.g.c += 0.5f;
+        s.b.c += 0.5f;
+    }
+    s.id = 0;
+    // Mip level from how many base level texels a pixel covers, the area of
+    // the triangle in texels over its area in pixels (both doubled). Each level
+    // is a quarter of the texels, rounded to the nearest one
+    int level = 0;
+    if (tri.texture && tri.texture->sampler.mipmaps && tri.texture->LevelCount() > 1)
+    {
+        float u[3], v[3];
+        for (int i = 0; i < 3; i++)
+        {
+            u[i] = t[i].u / t[i].w * tri.texture->image->levels[0].uScale;
+            v[i] = t[i].v / t[i].w * tri.texture->image->levels[0].vScale;
+        }
+        float texelArea = std::abs((u[1] - u[0]) * (v[2] - v[0]) - (v[1] - v[0]) * (u[2] - u[0]));
+        for (float limit = 2.0f * areaPixels; texelArea > limit && level < tri.texture->LevelCount() - 1; limit *= 4.0f)
+            level++;
+    }
+    s.texture = tri.texture ? tri.texture->View(level) : TextureView();
+    s.texWidth = s.texture.uScale;
+    s.texHeight = s.texture.vScale;
+
+    return true;
+}
+
+void Rasterizer::DrawLine(const RenderTarget &target, const RasterLine &line)
+{
+    int x0 = (int)std::floor(line.p[0].x), y0 = (int)std::floor(line.p[0].y);
+    int x1 = (int)std::floor(line.p[1].x), y1 = (int)std::floor(line.p[1].y);
+    float z0 = line.z[0], z1 = line.z[1];
+
+    // Step along the major axis, always in increasing order
+    bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+    int a0 = steep ? y0 : x0, a1 = steep ? y1 : x1;
+    int m0 = steep ? x0 : y0, m1 = steep ? x1 : y1;
+    if (a0 > a1)
+    {
+        std::swap(a0, a1);
+        std::swap(m0, m1);
+        std::swap(z0, z1);
+    }
+
+    // Clip major axis to target, minor axis is checked per pixel
+    int start = std::max(a0, steep ? target.minY : target.minX);
+    int end = std::min(a1, (steep ? target.maxY : target.maxX) - 1);
+    int minorMin = steep ? target.minX : target.minY;
+    int minorMax = (steep ? target.maxX : target.maxY) - 1;
+    if (start > end) return;
+
+    // Minor coordinate at step i is m0 + round(M * (i - a0) / D), kept as a
+    // quotient and remainder of 2 * D so it can start anywhere on the line
+    long long D = a1 - a0, M = m1 - m0;
+    long long twoD = D > 0 ? 2 * D : 2;
+    long long num = 2 * M * (start - a0) + D;
+    long long q = FloorDiv(num, twoD);
+    long long r = num - q * twoD;
+    float zStep = D > 0 ? (z1 - z0) / (float)D : 0.0f;
+
+    for (int i = start; i <= end; i++)
+    {
+        int m = m0 + (int)q;
+        if (m >= minorMin && m <= minorMax)
+        {
+            int index = steep ? i * target.width + m : m * target.width + i;
+            bool visible = true;
+            if (line.depthTest)
+            {
+                float z = z0 + zStep * (float)(i - a0);
+                visible = z - std::abs(z) * LINE_DEPTH_BIAS < target.depth[index];
+            }
+            if (visible) target.color[index] = line.color;
+        }
+
+        r += 2 * M;
+        if (r >= twoD) { q++; r -= twoD; }
+        else if (r < 0) { q--; r += twoD; }
+    }
+}
+
+void Rasterizer::ResolveRow(const RenderTarget &target, const TriangleSetup *setups, int y)
+{
+    const Uint32 *idRow = target.ids + y * target.width;
+    Uint32 *colorRow = target.color + y * target.width;
+    float py = (float)y + 0.5f;
+
+    // Same math as the raster paths, per pixel
+
+    for (int x = target.minX; x < target.maxX; x++)
+    {
+        Uint32 id = idRow[x];
+        if (id == VISIBILITY_EMPTY) continue;
+
+        const TriangleSetup &s = setups[id];
+        if (s.smooth)
+        {
+            float px = (float)x + 0.5f;
+            int r = (int)((s.r.c + s.r.dy * py) + s.r.dx * px);
+            int g = (int)((s.g.c + s.g.dy * py) + s.g.dx * px);
+            int b = (int)((s.b.c + s.b.dy * py) + s.b.dx * px);
+            BlendColors(&r, &g, &b, 1, 1, &colorRow[x]);
+            continue;
+        }
+        if (!s.texture.texels)
+        {
+            colorRow[x] = s.color;
+            continue;
+        }
+
+        float px = (float)x + 0.5f;
+        float z = (s.z.c + s.z.dy * py) + s.z.dx * px;
+        float u = ((s.u.c + s.u.dy * py) + s.u.dx * px) / z;
+        float v = ((s.v.c + s.v.dy * py) + s.v.dx * px) / z;
+
+        SampleTexels<LanesScalar>(s, u * s.texWidth, v * s.texHeight, 1, &colorRow[x]);
+    }
+}
+
+void Rasterizer::DrawSetup(const RenderTarget &target, const TriangleSetup &setup)
+{
+    // Clip bounding box to target
+    TriangleSetup s = setup;
+    s.minX = std::max(s.minX, target.minX);
+    s.maxX = std::min(s.maxX, target.maxX - 1);
+    s.minY = std::max(s.minY, target.minY);
+    s.maxY = std::min(s.maxY, target.maxY - 1);
+    if (s.minX > s.maxX || s.minY > s.maxY) return;
+
+    switch (path)
+    {
+        case RasterPath::AVX2:
+            RasterizeAVX2(target, s);
+            break;
+        case RasterPath::SSE2:
+            RasterizeSSE2(target, s);
+            break;
+        default:
+            RasterizeScalar(target, s);
+            break;
+    }
+}
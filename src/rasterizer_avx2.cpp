@@ -0,0 +1,15 @@
+// Compiled with -mavx2, only called when the CPU reports AVX2 support
+#include <raster_kernel.hpp>
+
+void RasterizeAVX2(const RenderTarget &target, const TriangleSetup &s)
+{
+#if defined(__AVX2__)
+    // Lanes step edges in 32 bits, large triangles take the 64-bit path
+    if (s.narrowEdges)
+        RasterizeLanes<LanesAVX2>(target, s);
+    else
+        RasterizeScalar(target, s);
+#else
+    RasterizeSSE2(target, s);
+#endif
+}
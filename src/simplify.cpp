@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+
+#include <simplify.hpp>
+
+// Open edges keep their place much more strongly than the surface does
+#define BOUNDARY_WEIGHT 10.0
+
+// Sum of squared distances to a set of planes, as the symmetric 4x4 matrix
+// of plane coefficient products (upper half, row by row)
+struct Quadric
+{
+    double q[10] = {0.0};
+
+    void AddPlane(double a, double b, double c, double d, double weight)
+    {
+        double p[4] = {a, b, c, d};
+        int k = 0;
+        for (int i = 0; i < 4; i++)
+            for (int j = i; j < 4; j++)
+                q[k++] += weight * p[i] * p[j];
+    }
+
+    void Add(const Quadric &other)
+    {
+        for (int k = 0; k < 10; k++) q[k] += other.q[k];
+    }
+
+    double Error(const Vec3 &p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+             + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+             + q[7] * z * z + 2.0 * q[8] * z
+             + q[9];
+    }
+};
+
+// Moving vertex from onto vertex to, with the stamps both had when queued
+struct Collapse
+{
+    double cost;
+    int from, to;
+    int fromStamp, toStamp;
+
+    bool operator > (const Collapse &other) const { return cost > other.cost; }
+};
+
+static Vec3 FaceNormal(const Vec3 &p0, const Vec3 &p1, const Vec3 &p2)
+{
+    Vec3 a = p0, b = p1, c = p2;
+    return (b - a).cross(c - a);
+}
+
+std::vector<MeshLOD> SimplifyMesh(const Mesh &mesh, const std::vector<int> &targets)
+{
+    const std::vector<Vec3> &positions = mesh.positions;
+    int vertexCount = (int)positions.size();
+    int triangleCount = (int)mesh.indices.size() / 3;
+
+    // Working copy of the triangles, and the live ones around each vertex
+    std::vector<int> corners = mesh.indices;
+    std::vector<int> uvCorners = mesh.uvIndices;
+    bool hasNormals = mesh.normalIndices.size() == mesh.indices.size();
+    std::vector<int> normalCorners = hasNormals ? mesh.normalIndices : std::vector<int>();
+    std::vector<bool> removed(triangleCount, false);
+    std::vector<std::vector<int>> vertexTriangles(vertexCount);
+    int live = 0;
+    for (int t = 0; t < triangleCount; t++)
+    {
+        int *c = &corners[3 * t];
+        if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0])
+        {
+            removed[t] = true;
+            continue;
+        }
+        for (int k = 0; k < 3; k++)
+            vertexTriangles[c[k]].push_back(t);
+        live++;
+    }
+
+    // Each vertex starts with the planes of its faces
+    std::vector<Quadric> quadrics(vertexCount);
+    std::map<std::pair<int, int>, int> edgeFaces;
+    for (int t = 0; t < triangleCount; t++)
+    {
+        if (removed[t]) continue;
+        int *c = &corners[3 * t];
+        Vec3 n = FaceNormal(positions[c[0]], positions[c[1]], positions[c[2]]);
+        if (n.magnitude() == 0.0f) continue;
+        n = n.unit();
+        Vec3 p0 = positions[c[0]];
+        double d = -n.dot(p0);
+        for (int k = 0; k < 3; k++)
+        {
+            quadrics[c[k]].AddPlane(n.x, n.y, n.z, d, 1.0);
+            int a = c[k], b = c[(k + 1) % 3];
+            edgeFaces[{std::min(a, b), std::max(a, b)}]++;
+        }
+    }
+
+    // Edges with one face get a plane through them, across the face, so
+    // holes and open borders don't shrink
+    for (int t = 0; t < triangleCount; t++)
+    {
+        if (removed[t]) continue;
+        int *c = &corners[3 * t];
+        Vec3 n = FaceNormal(positions[c[0]], positions[c[1]], positions[c[2]]);
+        for (int k = 0; k < 3; k++)
+        {
+            int a = c[k], b = c[(k + 1) % 3];
+            if (edgeFaces[{std::min(a, b), std::max(a, b)}] != 1) continue;
+
+            Vec3 pa = positions[a], pb = positions[b];
+            Vec3 side = (pb - pa).cross(n);
+            if (side.magnitude() == 0.0f) continue;
+            side = side.unit();
+            double d = -side.dot(pa);
+            quadrics[a].AddPlane(side.x, side.y, side.z, d, BOUNDARY_WEIGHT);
+            quadrics[b].AddPlane(side.x, side.y, side.z, d, BOUNDARY_WEIGHT);
+        }
+    }
+
+    // Cheapest collapses first. Entries go stale when either vertex changes,
+    // the stamps tell
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    std::vector<int> stamps(vertexCount, 0);
+    std::vector<bool> collapsed(vertexCount, false);
+    auto queueEdge = [&](int a, int b)
+    {
+        Quadric q = quadrics[a];
+        q.Add(quadrics[b]);
+        double ontoB = q.Error(positions[b]), ontoA = q.Error(positions[a]);
+        if (ontoB <= ontoA)
+            heap.push({ontoB, a, b, stamps[a], stamps[b]});
+        else
+            heap.push({ontoA, b, a, stamps[b], stamps[a]});
+    };
+    for (auto &edge : edgeFaces)
+        queueEdge(edge.first.first, edge.first.second);
+
+    // Moving from onto to must not turn any of from's other faces over
+    auto canCollapse = [&](int from, int to)
+    {
+        for (int t : vertexTriangles[from])
+        {
+            if (removed[t]) continue;
+            int *c = &corners[3 * t];
+            if (c[0] == to || c[1] == to || c[2] == to) continue;
+
+            Vec3 p[3] = {positions[c[0]], positions[c[1]], positions[c[2]]};
+            Vec3 before = FaceNormal(p[0], p[1], p[2]);
+            for (int k = 0; k < 3; k++)
+                if (c[k] == from) p[k] = positions[to];
+            Vec3 after = FaceNormal(p[0], p[1], p[2]);
+            if (after.dot(before) <= 0.0f)
+                return false;
+        }
+        return true;
+    };
+
+    std::vector<MeshLOD> levels;
+    double error = 0.0;
+    std::vector<int> neighbours;
+    std::vector<std::pair<int, int>> uvMoves, normalMoves;
+
+    // Corner attribute that was first in a move gets the second
+    auto moveCorner = [](int &attribute, const std::vector<std::pair<int, int>> &moves)
+    {
+        for (auto &move : moves)
+            if (attribute == move.first)
+            {
+                attribute = move.second;
+                break;
+            }
+    };
+
+    for (int target : targets)
+    {
+        int liveBefore = live;
+        while (live > target && !heap.empty())
+        {
+            Collapse c = heap.top();
+            heap.pop();
+            if (collapsed[c.from] || collapsed[c.to]) continue;
+            if (stamps[c.from] != c.fromStamp || stamps[c.to] != c.toStamp) continue;
+            if (!canCollapse(c.from, c.to)) continue;
+
+            error = std::max(error, c.cost);
+
+            // Faces on the edge go away. Their corners tell which UV and
+            // normal from's corners take on to, per side of a seam
+            uvMoves.clear();
+            normalMoves.clear();
+            for (int t : vertexTriangles[c.from])
+            {
+                if (removed[t]) continue;
+                int *tc = &corners[3 * t];
+                if (tc[0] != c.to && tc[1] != c.to && tc[2] != c.to) continue;
+
+                int kFrom = 0, kTo = 0;
+                for (int k = 0; k < 3; k++)
+                {
+                    if (tc[k] == c.from) kFrom = k;
+                    if (tc[k] == c.to) kTo = k;
+                }
+                uvMoves.push_back({uvCorners[3 * t + kFrom], uvCorners[3 * t + kTo]});
+                if (hasNormals)
+                    normalMoves.push_back({normalCorners[3 * t + kFrom], normalCorners[3 * t + kTo]});
+                removed[t] = true;
+                live--;
+            }
+
+            // The others now use to
+            for (int t : vertexTriangles[c.from])
+            {
+                if (removed[t]) continue;
+                for (int k = 0; k < 3; k++)
+                {
+                    if (corners[3 * t + k] != c.from) continue;
+                    corners[3 * t + k] = c.to;
+                    moveCorner(uvCorners[3 * t + k], uvMoves);
+                    if (hasNormals)
+                        moveCorner(normalCorners[3 * t + k], normalMoves);
+                }
+                vertexTriangles[c.to].push_back(t);
+            }
+            vertexTriangles[c.from].clear();
+            collapsed[c.from] = true;
+            quadrics[c.to].Add(quadrics[c.from]);
+            stamps[c.to]++;
+
+            // Drop faces gone from to's list, and queue its edges again
+            std::vector<int> &around = vertexTriangles[c.to];
+            around.erase(std::remove_if(around.begin(), around.end(), [&](int t) { return removed[t]; }), around.end());
+            neighbours.clear();
+            for (int t : around)
+                for (int k = 0; k < 3; k++)
+                    if (corners[3 * t + k] != c.to)
+                        neighbours.push_back(corners[3 * t + k]);
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+            for (int n : neighbours)
+                queueEdge(c.to, n);
+        }
+
+        // Nothing left to collapse
+        if (live == liveBefore)
+            break;
+
+        // Take the level, with only the positions it uses
+        MeshLOD level;
+        std::vector<int> remap(vertexCount, -1);
+        for (int t = 0; t < triangleCount; t++)
+        {
+            if (removed[t]) continue;
+            for (int k = 0; k < 3; k++)
+            {
+                int v = corners[3 * t + k];
+                if (remap[v] < 0)
+                {
+                    remap[v] = (int)level.positions.size();
+                    level.positions.push_back(positions[v]);
+                }
+                level.indices.push_back(remap[v]);
+                level.uvIndices.push_back(uvCorners[3 * t + k]);
+                if (hasNormals)
+                    level.normalIndices.push_back(normalCorners[3 * t + k]);
+            }
+            level.colors.push_back(mesh.colors[t]);
+        }
+        level.error = (float)std::sqrt(error);
+        levels.push_back(level);
+    }
+
+    return levels;
+}
@@ -1,22 +1,201 @@
 #include <texture.hpp>
+#include <color.hpp>
+#include <lighting.hpp>
 
-Texture::Texture()
+// Average of 2x2 texels (or 2x1, 1x2 on the last levels) of the level
+// above, in linear light
+static void Downsample(const TextureLevel &from, Uint32 *to, int rowLength, int rows)
 {
-    loaded = false;
-    surface = NULL;
+    int stepX = from.widthMask + 1 > rowLength ? 1 : 0;
+    int stepY = from.heightMask + 1 > rows ? 1 : 0;
+    float weight = 1.0f / (float)((stepX + 1) * (stepY + 1));
+
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < rowLength; x++)
+        {
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            for (int dy = 0; dy <= stepY; dy++)
+                for (int dx = 0; dx <= stepX; dx++)
+                {
+                    SDL_Color c = UnpackColor(from.texels[((y << stepY) + dy) << from.rowShift | ((x << stepX) + dx)]);
+                    sum[0] += srgbToLinear[c.r];
+                    sum[1] += srgbToLinear[c.g];
+                    sum[2] += srgbToLinear[c.b];
+                }
+
+            Uint8 channel[3];
+            for (int i = 0; i < 3; i++)
+                channel[i] = linearToSRGB[(int)(sum[i] * weight * LINEAR_STEPS + 0.5f)];
+            to[y * rowLength + x] = PackColor({channel[0], channel[1], channel[2], SDL_ALPHA_OPAQUE});
+        }
 }
 
-Texture::~Texture()
+// Image stretched to rowLength x rows, blending the 2x2 texels around each
+// one in linear light. Taps past an edge wrap to the other, as the image tiles
+static void Resample(const std::vector<Uint32> &from, int fromWidth, int fromHeight, Uint32 *to, int rowLength, int rows)
 {
-    // printf("Freeing texture\n");
-    // if (surface)
-    // {
-    //     SDL_FreeSurface(surface);
-    //     surface = NULL;
-    // }
+    float scaleX = (float)fromWidth / (float)rowLength;
+    float scaleY = (float)fromHeight / (float)rows;
+
+    for (int y = 0; y < rows; y++)
+    {
+        float fromY = ((float)y + 0.5f) * scaleY - 0.5f;
+        int top = (int)std::floor(fromY);
+        float weightY = fromY - (float)top;
+        int rowAt[2] = {(top + fromHeight) % fromHeight, (top + 1) % fromHeight};
+
+        for (int x = 0; x < rowLength; x++)
+        {
+            float fromX = ((float)x + 0.5f) * scaleX - 0.5f;
+            int left = (int)std::floor(fromX);
+            float weightX = fromX - (float)left;
+            int columnAt[2] = {(left + fromWidth) % fromWidth, (left + 1) % fromWidth};
+
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            for (int dy = 0; dy < 2; dy++)
+                for (int dx = 0; dx < 2; dx++)
+                {
+                    float weight = (dx ? weightX : 1.0f - weightX) * (dy ? weightY : 1.0f - weightY);
+                    SDL_Color c = UnpackColor(from[rowAt[dy] * fromWidth + columnAt[dx]]);
+                    sum[0] += srgbToLinear[c.r] * weight;
+                    sum[1] += srgbToLinear[c.g] * weight;
+                    sum[2] += srgbToLinear[c.b] * weight;
+                }
+
+            Uint8 channel[3];
+            for (int i = 0; i < 3; i++)
+                channel[i] = linearToSRGB[std::min((int)(sum[i] * LINEAR_STEPS + 0.5f), LINEAR_STEPS)];
+            to[y * rowLength + x] = PackColor({channel[0], channel[1], channel[2], SDL_ALPHA_OPAQUE});
+        }
+    }
 }
 
-bool Texture::init(std::string filePath)
+TextureRegistry &TextureRegistry::Shared()
+{
+    static TextureRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<const TextureImage> TextureRegistry::Load(const std::string &filePath, TextureLayout layout)
+{
+    // Already held by some texture
+    std::shared_ptr<const TextureImage> held = images[{filePath, layout}].lock();
+    if (held) return held;
+
+    // Try to load image
+    SDL_Surface *loadedSurface = SDL_LoadBMP(filePath.c_str());
+    if (loadedSurface == NULL) {
+        printf("Unable to load BMP at path %s! SDL Error: %s\n", filePath.c_str(), SDL_GetError());
+        return NULL;
+    }
+
+    // Convert to the framebuffer format, whatever the file had
+    SDL_Surface *surface = SDL_ConvertSurfaceFormat(loadedSurface, FRAMEBUFFER_FORMAT, 0);
+    SDL_FreeSurface(loadedSurface);
+    if (surface == NULL) {
+        printf("Unable to convert BMP at path %s! SDL Error: %s\n", filePath.c_str(), SDL_GetError());
+        return NULL;
+    }
+
+    std::shared_ptr<TextureImage> image = std::make_shared<TextureImage>();
+    image->width = surface->w; image->height = surface->h;
+
+    // Power of two size around it, then the levels below down to 1 x 1
+    int rowLength = 1, rowShift = 0, rows = 1, rowsShift = 0;
+    while (rowLength < image->width) { rowLength <<= 1; rowShift++; }
+    while (rows < image->height) { rows <<= 1; rowsShift++; }
+
+    std::vector<size_t> offsets;
+    size_t total = 0;
+    for (int k = 0; k <= std::max(rowShift, rowsShift); k++)
+    {
+        int levelLength = std::max(rowLength >> k, 1), levelRows = std::max(rows >> k, 1);
+        TextureLevel level;
+        level.width = levelLength;
+        level.height = levelRows;
+        level.widthMask = levelLength - 1;
+        level.heightMask = levelRows - 1;
+        level.rowShift = std::max(rowShift - k, 0);
+        level.uScale = (float)levelLength;
+        level.vScale = (float)levelRows;
+        image->levels.push_back(level);
+        offsets.push_back(total);
+        total += (size_t)levelLength * levelRows;
+    }
+    image->texels.resize(total);
+    for (size_t k = 0; k < image->levels.size(); k++)
+        image->levels[k].texels = image->texels.data() + offsets[k];
+
+    // Copy the texels, alpha forced opaque
+    std::vector<Uint32> pixels((size_t)image->width * image->height);
+    SDL_LockSurface(surface);
+    for (int y = 0; y < image->height; y++)
+    {
+        const Uint32 *row = (const Uint32 *)((const Uint8 *)surface->pixels + y * surface->pitch);
+        for (int x = 0; x < image->width; x++)
+            pixels[(size_t)y * image->width + x] = row[x] | 0xFF000000u;
+    }
+    SDL_UnlockSurface(surface);
+    SDL_FreeSurface(surface);
+
+    // Other sizes are stretched to the power of two one, so masking wraps
+    // coordinates exactly on every level
+    Uint32 *texels = image->texels.data();
+    if (rowLength == image->width && rows == image->height)
+        std::copy(pixels.begin(), pixels.end(), texels);
+    else
+        Resample(pixels, image->width, image->height, texels, rowLength, rows);
+
+    for (size_t k = 1; k < image->levels.size(); k++)
+    {
+        const TextureLevel &level = image->levels[k];
+        Downsample(image->levels[k - 1], texels + offsets[k], level.widthMask + 1, level.heightMask + 1);
+    }
+
+    // Then reorder each level into the layout asked for
+    image->layout = layout;
+    std::vector<Uint32> reordered;
+    for (size_t k = 0; k < image->levels.size() && layout != TextureLayout::Linear; k++)
+    {
+        TextureLevel &level = image->levels[k];
+        int levelLength = level.widthMask + 1, levelRows = level.heightMask + 1;
+        if (layout == TextureLayout::Tiled && (levelLength < 4 || levelRows < 4))
+            continue;
+
+        level.layout = layout;
+        level.squareShift = 0;
+        while ((2 << level.squareShift) <= std::min(levelLength, levelRows)) level.squareShift++;
+
+        Uint32 *levelTexels = texels + offsets[k];
+        reordered.resize((size_t)levelLength * levelRows);
+        for (int y = 0; y < levelRows; y++)
+            for (int x = 0; x < levelLength; x++)
+                reordered[TexelIndex(level, x, y)] = levelTexels[y * levelLength + x];
+        std::copy(reordered.begin(), reordered.end(), levelTexels);
+    }
+
+    images[{filePath, layout}] = image;
+    return image;
+}
+
+int TextureRegistry::Count()
+{
+    int count = 0;
+    for (auto it = images.begin(); it != images.end();)
+    {
+        // Forget images no texture holds anymore
+        if (it->second.expired())
+            it = images.erase(it);
+        else
+        {
+            count++;
+            it++;
+        }
+    }
+    return count;
+}
+
+bool Texture::init(std::string filePath, TextureLayout layout)
 {
     // Check if already loaded
     if (loaded)
@@ -25,16 +204,15 @@ bool Texture::init(std::string filePath)
         return false;
     }
 
-    // Try to load image
-    surface = SDL_LoadBMP(filePath.c_str());
-    if (surface == NULL) {
-        printf("Unable to load BMP at path %s! SDL Error: %s\n", filePath.c_str(), SDL_GetError());
+    image = TextureRegistry::Shared().Load(filePath, layout);
+    if (!image)
+    {
         loaded = false;
         return loaded;
     }
 
     // Set size
-    width = surface->w; height = surface->h;
+    width = image->width; height = image->height;
 
     // Change states
     loaded = true;
@@ -47,6 +225,7 @@ bool Texture::init(SDL_Color color)
 {
     // Set base color
     baseColor = color;
+    image = NULL;
 
     // Change states
     loaded = true;
@@ -55,7 +234,7 @@ bool Texture::init(SDL_Color color)
     return loaded;
 }
 
-SDL_Color Texture::GetColorAt(int x, int y)
+SDL_Color Texture::GetColorAt(int x, int y) const
 {
     // Check if not loaded
     if (!loaded)
@@ -67,9 +246,6 @@ SDL_Color Texture::GetColorAt(int x, int y)
     // Check if is base color
     if (isBaseColor) return baseColor;
 
-    // If not base color, check for surface
-    if (!surface) return {0, 0, 0, 0};
-
     // Check if out of bounds
     if (x < 0 || x >= width || y < 0 || y >= height)
     {
@@ -77,79 +253,25 @@ SDL_Color Texture::GetColorAt(int x, int y)
         return {0, 0, 0, 0};
     }
 
-    // Declare color
-    SDL_Color rgb;
-
-    // Get pixel data
-    Uint32 data = GetPixel(x, y);
-
-    // Get RGB
-    SDL_GetRGB(data, surface->format, &rgb.r, &rgb.g, &rgb.b);
-
-    // Set alpha to max
-    rgb.a = SDL_ALPHA_OPAQUE;
-    return rgb;
+    // Level 0 may be stretched to a power of two size
+    const TextureLevel &level = image->levels[0];
+    return UnpackColor(level.texels[TexelIndex(level, x * level.width / width, y * level.height / height)]);
 }
 
-// Get pixel data
-Uint32 Texture::GetPixel(int x, int y)
+int Texture::LevelCount() const
 {
-    int bpp = surface->format->BytesPerPixel;
-    /* Here p is the address to the pixel we want to retrieve */
-    Uint8 *p = (Uint8 *)surface->pixels + y * surface->pitch + x * bpp;
-
-    switch (bpp)
-    {
-        case 1:
-            return *p;
-            break;
-
-        case 2:
-            return *(Uint16 *)p;
-            break;
-
-        case 3:
-            if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
-                return p[0] << 16 | p[1] << 8 | p[2];
-            else
-                return p[0] | p[1] << 8 | p[2] << 16;
-            break;
-
-        case 4:
-            return *(Uint32 *)p;
-            break;
-
-        default:
-            return 0;       /* shouldn't happen, but avoids warnings */
-    }
+    return loaded && !isBaseColor && image ? (int)image->levels.size() : 0;
 }
 
-void Texture::swap(Texture& first, Texture& second)
+TextureView Texture::View(int level) const
 {
-    // by swapping the members of two objects,
-    // the two objects are effectively swapped
-    std::swap(first.loaded, second.loaded);
-    std::swap(first.width, second.width);
-    std::swap(first.height, second.height);
-    std::swap(first.surface, second.surface);
-}
+    TextureView view;
+    view.sampler = sampler;
+    int count = LevelCount();
+    if (count == 0)
+        return view;
 
-Texture& Texture::operator=(Texture other)
-{
-    swap(*this, other);
-
-    return *this;
+    level = std::min(std::max(level, 0), count - 1);
+    (TextureLevel &)view = image->levels[level];
+    return view;
 }
-
-// Texture::Texture(const Texture& other)
-//     : loaded(other.loaded),
-//       width(other.width),
-//       height(other.height)
-//     //   mArray(mSize ? new int[mSize] : nullptr)
-// {
-//     printf("Copy ctor\n");
-//     // note that this is non-throwing, because of the data
-//     // types being used; more attention to detail with regards
-//     // to exceptions must be given in a more general case, however
-//     std::copy(other.surface, other.surface, surface);
-// }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include <thread_pool.hpp>
+
+ThreadPool::ThreadPool()
+{
+    nextIndex = 0;
+}
+
+ThreadPool::~ThreadPool()
+{
+    StopWorkers();
+}
+
+void ThreadPool::SetThreadCount(int count)
+{
+    if (count < 1) count = 1;
+    if (count == threadCount) return;
+
+    StopWorkers();
+    threadCount = count;
+
+    // Calling thread is one of the threads. Workers only run jobs started
+    // after they were created, the generation is read here since a worker
+    // may not get to run before the next job is posted
+    for (int i = 0; i < threadCount - 1; i++)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, generation);
+}
+
+void ThreadPool::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+
+    stopping = false;
+}
+
+void ThreadPool::ParallelFor(int count, std::function<void(int)> f)
+{
+    if (count <= 0) return;
+
+    // Nothing to share, run inline
+    if (workers.empty() || count == 1)
+    {
+        for (int i = 0; i < count; i++)
+            f(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = f;
+        jobCount = count;
+        nextIndex = 0;
+        busyWorkers = (int)workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    // Help out, then wait for the workers to finish
+    RunJobs();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::RunJobs()
+{
+    int i;
+    while ((i = nextIndex++) < jobCount)
+        job(i);
+}
+
+void ThreadPool::WorkerLoop(unsigned int seen)
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+
+        RunJobs();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+        }
+        done.notify_one();
+    }
+}
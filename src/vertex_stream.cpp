@@ -0,0 +1,138 @@
+#include <vertex_kernel.hpp>
+
+void VertexStream::Resize(int count)
+{
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    w.resize(count);
+}
+
+void TransformPositionsScalar(const Mat4 &m, const Vec3 *in, Vec3 scale, int begin, int end, VertexStream &out)
+{
+    TransformPositionsLanes<VertexLanesScalar>(m, in, scale, begin, end, out);
+}
+
+void TransformPositionsSSE2(const Mat4 &m, const Vec3 *in, Vec3 scale, int begin, int end, VertexStream &out)
+{
+#if defined(__SSE2__)
+    begin = TransformPositionsLanes<VertexLanesSSE2>(m, in, scale, begin, end, out);
+#endif
+    TransformPositionsLanes<VertexLanesScalar>(m, in, scale, begin, end, out);
+}
+
+void TransformStreamScalar(const Mat4 &m, const VertexStream &in, int begin, int end, VertexStream &out)
+{
+    TransformStreamLanes<VertexLanesScalar>(m, in, begin, end, out);
+}
+
+void TransformStreamSSE2(const Mat4 &m, const VertexStream &in, int begin, int end, VertexStream &out)
+{
+#if defined(__SSE2__)
+    begin = TransformStreamLanes<VertexLanesSSE2>(m, in, begin, end, out);
+#endif
+    TransformStreamLanes<VertexLanesScalar>(m, in, begin, end, out);
+}
+
+void ProjectStreamScalar(const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, float halfWidth, float halfHeight, int begin, int end, VertexStream &out, Uint8 *codes)
+{
+    ProjectStreamLanes<VertexLanesScalar>(m, planes, in, halfWidth, halfHeight, begin, end, out, codes);
+}
+
+void ProjectStreamSSE2(const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, float halfWidth, float halfHeight, int begin, int end, VertexStream &out, Uint8 *codes)
+{
+#if defined(__SSE2__)
+    begin = ProjectStreamLanes<VertexLanesSSE2>(m, planes, in, halfWidth, halfHeight, begin, end, out, codes);
+#endif
+    ProjectStreamLanes<VertexLanesScalar>(m, planes, in, halfWidth, halfHeight, begin, end, out, codes);
+}
+
+void LightStreamScalar(const VertexStream &normals, const float *lights, int lightCount, float ambient, int begin, int end, float *out)
+{
+    LightStreamLanes<VertexLanesScalar>(normals, lights, lightCount, ambient, begin, end, out);
+}
+
+void LightStreamSSE2(const VertexStream &normals, const float *lights, int lightCount, float ambient, int begin, int end, float *out)
+{
+#if defined(__SSE2__)
+    begin = LightStreamLanes<VertexLanesSSE2>(normals, lights, lightCount, ambient, begin, end, out);
+#endif
+    LightStreamLanes<VertexLanesScalar>(normals, lights, lightCount, ambient, begin, end, out);
+}
+
+void TransformPositions(RasterPath path, const Mat4 &m, const Vec3 *positions, Vec3 scale, int count, VertexStream &out)
+{
+    out.Resize(count);
+
+    switch (path)
+    {
+        case RasterPath::AVX2:
+            TransformPositionsAVX2(m, positions, scale, 0, count, out);
+            break;
+        case RasterPath::SSE2:
+            TransformPositionsSSE2(m, positions, scale, 0, count, out);
+            break;
+        default:
+            TransformPositionsScalar(m, positions, scale, 0, count, out);
+            break;
+    }
+}
+
+void TransformStream(RasterPath path, const Mat4 &m, const VertexStream &in, VertexStream &out)
+{
+    int count = in.Size();
+    out.Resize(count);
+
+    switch (path)
+    {
+        case RasterPath::AVX2:
+            TransformStreamAVX2(m, in, 0, count, out);
+            break;
+        case RasterPath::SSE2:
+            TransformStreamSSE2(m, in, 0, count, out);
+            break;
+        default:
+            TransformStreamScalar(m, in, 0, count, out);
+            break;
+    }
+}
+
+void ProjectStream(RasterPath path, const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, int width, int height, VertexStream &out, std::vector<Uint8> &codes)
+{
+    int count = in.Size();
+    out.Resize(count);
+    codes.resize(count);
+
+    float halfWidth = 0.5f * width, halfHeight = 0.5f * height;
+    switch (path)
+    {
+        case RasterPath::AVX2:
+            ProjectStreamAVX2(m, planes, in, halfWidth, halfHeight, 0, count, out, codes.data());
+            break;
+        case RasterPath::SSE2:
+            ProjectStreamSSE2(m, planes, in, halfWidth, halfHeight, 0, count, out, codes.data());
+            break;
+        default:
+            ProjectStreamScalar(m, planes, in, halfWidth, halfHeight, 0, count, out, codes.data());
+            break;
+    }
+}
+
+void LightStream(RasterPath path, const VertexStream &normals, const float *lights, int lightCount, float ambient, std::vector<float> &out)
+{
+    int count = normals.Size();
+    out.resize(count);
+
+    switch (path)
+    {
+        case RasterPath::AVX2:
+            LightStreamAVX2(normals, lights, lightCount, ambient, 0, count, out.data());
+            break;
+        case RasterPath::SSE2:
+            LightStreamSSE2(normals, lights, lightCount, ambient, 0, count, out.data());
+            break;
+        default:
+            LightStreamScalar(normals, lights, lightCount, ambient, 0, count, out.data());
+            break;
+    }
+}
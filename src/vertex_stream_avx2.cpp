@@ -0,0 +1,42 @@
+// Compiled with -mavx2, only called when the CPU reports AVX2 support
+#include <vertex_kernel.hpp>
+
+void TransformPositionsAVX2(const Mat4 &m, const Vec3 *in, Vec3 scale, int begin, int end, VertexStream &out)
+{
+#if defined(__AVX2__)
+    begin = TransformPositionsLanes<VertexLanesAVX2>(m, in, scale, begin, end, out);
+    TransformPositionsLanes<VertexLanesScalar>(m, in, scale, begin, end, out);
+#else
+    TransformPositionsSSE2(m, in, scale, begin, end, out);
+#endif
+}
+
+void TransformStreamAVX2(const Mat4 &m, const VertexStream &in, int begin, int end, VertexStream &out)
+{
+#if defined(__AVX2__)
+    begin = TransformStreamLanes<VertexLanesAVX2>(m, in, begin, end, out);
+    TransformStreamLanes<VertexLanesScalar>(m, in, begin, end, out);
+#else
+    TransformStreamSSE2(m, in, begin, end, out);
+#endif
+}
+
+void ProjectStreamAVX2(const Mat4 &m, const ClipPlanes &planes, const VertexStream &in, float halfWidth, float halfHeight, int begin, int end, VertexStream &out, Uint8 *codes)
+{
+#if defined(__AVX2__)
+    begin = ProjectStreamLanes<VertexLanesAVX2>(m, planes, in, halfWidth, halfHeight, begin, end, out, codes);
+    ProjectStreamLanes<VertexLanesScalar>(m, planes, in, halfWidth, halfHeight, begin, end, out, codes);
+#else
+    ProjectStreamSSE2(m, planes, in, halfWidth, halfHeight, begin, end, out, codes);
+#endif
+}
+
+void LightStreamAVX2(const VertexStream &normals, const float *lights, int lightCount, float ambient, int begin, int end, float *out)
+{
+#if defined(__AVX2__)
+    begin = LightStreamLanes<VertexLanesAVX2>(normals, lights, lightCount, ambient, begin, end, out);
+    LightStreamLanes<VertexLanesScalar>(normals, lights, lightCount, ambient, begin, end, out);
+#else
+    LightStreamSSE2(normals, lights, lightCount, ambient, begin, end, out);
+#endif
+}
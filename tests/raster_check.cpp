@@ -0,0 +1,155 @@
+#include <engine.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Renders the clock scene off screen on every rasterizer path the CPU has, on
+// one thread and on several, with and without the visibility buffer, and
+// checks each frame against the scalar single thread one, pixel for pixel
+
+// Point at distance from the clock center, angle around it, height above it
+Vec3 facePoint(float distance, float angle, float height)
+{
+    return {distance * std::cos(angle), height, distance * std::sin(angle)};
+}
+
+// Still clock: face, arms, middle ball and marks, plus two textured blocks
+// so sampling is checked too
+class CheckScene : public Engine3D
+{
+public:
+    void setup() override;
+
+    // If the block textures were found
+    bool texturesLoaded = true;
+};
+
+void CheckScene::setup()
+{
+    // Call base class setup
+    Engine3D::setup();
+
+    // Looking down at the clock
+    cam.position = {0.0f, 22.0f, 3.0f};
+    cam.rotate(-M_PIf * .472f, 0.0f);
+
+    // Clock floor
+    Mesh floor = Mesh::Cylinder(20.0f, 2.0f, 36);
+    floor.texture.init(SDL_Color{255, 255, 255, 255});
+    addMesh(floor);
+
+    // Second, minute and hour arms
+    float armRadius[3] = {0.5f, 0.8f, 1.0f};
+    float armLength[3] = {12.0f, 18.0f, 9.0f};
+    float armAngle[3] = {M_PIf * 0.1f, M_PIf * 1.3f, M_PIf * 0.2f};
+    SDL_Color armColor[3] = {{255, 0, 0, 255}, {50, 50, 50, 255}, {50, 50, 50, 255}};
+    for (int i = 0; i < 3; i++)
+    {
+        Mesh arm = Mesh::Cone(armRadius[i], armLength[i], 36);
+        arm.position = facePoint(armLength[i] * 0.5f, armAngle[i], 1.0f);
+        arm.rotation = {M_PIf * 0.5f, 0.0f, armAngle[i] + M_PIf * 1.5f};
+        arm.texture.init(armColor[i]);
+        addMesh(arm);
+    }
+
+    // Middle ball
+    Mesh ball = Mesh::Sphere(1.6f, 36);
+    ball.texture.init(SDL_Color{50, 50, 50, 255});
+    ball.position = {0.0f, 1.0f, 0.0f};
+    addMesh(ball);
+
+    // Hour and minute marks
+    for (int i = 0; i < 60; i++)
+    {
+        float angle = M_PIf / 30.0f * (float)i;
+        bool hour = i % 5 == 0;
+        float length = hour ? 3.0f : 0.6f;
+
+        Mesh mark = Mesh::Cylinder(hour ? 0.2f : 0.1f, length, 36);
+        mark.position = facePoint(20.0f - length * 0.5f - 1.0f, angle, 1.0f);
+        mark.rotation = {M_PIf * 0.5f, 0.0f, angle + M_PIf * 0.5f};
+        mark.texture.init(SDL_Color{15, 15, 15, 255});
+        addMesh(mark);
+    }
+
+    // Textured blocks, point sampled and bilinear
+    const char *images[2] = {"assets/bmp/block_tex.bmp", "assets/bmp/dirt.bmp"};
+    for (int i = 0; i < 2; i++)
+    {
+        Mesh block = Mesh::Cube();
+        texturesLoaded = block.texture.init(images[i]) && texturesLoaded;
+        block.texture.sampler.filter = i ? TextureFilter::Bilinear : TextureFilter::Nearest;
+        block.size = {3.0f, 3.0f, 3.0f};
+        block.position = facePoint(8.0f, M_PIf * (0.6f + (float)i), 2.0f);
+        block.rotation = {0.3f, 0.5f + (float)i, 0.1f};
+        addMesh(block);
+    }
+
+    // Add light
+    Light light;
+    light.direction = {0.8f, -1.0f, 0.0f};
+    light.brightness = 1.0f;
+    addLight(light);
+}
+
+int main()
+{
+    CheckScene scene;
+    if (!scene.initHeadless(600, 600))
+    {
+        printf("Error initializing engine\n");
+        return 1;
+    }
+    scene.setup();
+    if (!scene.texturesLoaded)
+    {
+        printf("Run from the repository root, block textures are read from assets/bmp\n");
+        return 1;
+    }
+
+    const char *pathNames[3] = {"Scalar", "SSE2", "AVX2"};
+    int lastPath = (int)scene.rasterizer.path;
+    int threads[2] = {1, std::max(SDL_GetCPUCount(), 4)};
+    int pixels = scene.getWidth() * scene.getHeight();
+
+    int failed = 0;
+    for (int smooth = 0; smooth < 2; smooth++)
+    {
+        std::vector<Uint32> reference;
+        for (int path = 0; path <= lastPath; path++)
+            for (int t = 0; t < 2; t++)
+                for (int visibility = 0; visibility < 2; visibility++)
+                {
+                    scene.smoothShading = smooth;
+                    scene.rasterizer.path = (RasterPath)path;
+                    scene.SetThreadCount(threads[t]);
+                    scene.visibilityBuffer = visibility;
+                    scene.RenderFrame();
+
+                    const Uint32 *frame = scene.GetColorBuffer();
+                    printf("%s shading, %-6s path, %2d threads, visibility buffer %-3s: ",
+                           smooth ? "smooth" : "flat", pathNames[path], threads[t], visibility ? "on" : "off");
+
+                    // First frame is the reference, it must have drawn something
+                    if (reference.empty())
+                    {
+                        reference.assign(frame, frame + pixels);
+                        int drawn = 0;
+                        for (int i = 0; i < pixels; i++)
+                            drawn += reference[i] != reference[0];
+                        printf("reference, %d pixels drawn\n", drawn);
+                        failed += drawn == 0;
+                        continue;
+                    }
+
+                    int differ = 0;
+                    for (int i = 0; i < pixels; i++)
+                        differ += frame[i] != reference[i];
+                    printf("%d pixels differ\n", differ);
+                    failed += differ != 0;
+                }
+    }
+
+    printf(failed ? "FAILED\n" : "OK\n");
+    return failed ? 1 : 0;
+}
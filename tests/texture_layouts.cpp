@@ -0,0 +1,105 @@
+#include <engine.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Times frames of a wall of minified, rotated textured cubes off screen with
+// the texels stored in each layout, with and without mipmaps, so the cost of
+// texel fetches in each memory order can be compared
+
+// Frames drawn before timing, and timed
+#define WARMUP_FRAMES 5
+#define TIMED_FRAMES 60
+
+// Cubes on each side of the wall
+#define WALL_SIDE 8
+
+// Wall of cubes turned so their texture rows run across screen columns,
+// where row after row texels are furthest apart
+class LayoutScene : public Engine3D
+{
+public:
+    LayoutScene(TextureLayout layout, bool mipmaps) : layout(layout), mipmaps(mipmaps) {}
+
+    void setup() override;
+
+    // If the textures were found
+    bool texturesLoaded = true;
+
+private:
+    TextureLayout layout;
+    bool mipmaps;
+};
+
+void LayoutScene::setup()
+{
+    // Call base class setup
+    Engine3D::setup();
+
+    // Looking at the wall from far enough that each face is a fraction of
+    // its texels wide
+    cam.position = {0.0f, 0.0f, 18.0f};
+
+    const char *images[2] = {"assets/bmp/block_tex.bmp", "assets/bmp/monkey_tex.bmp"};
+    for (int i = 0; i < WALL_SIDE; i++)
+        for (int j = 0; j < WALL_SIDE; j++)
+        {
+            Mesh cube = Mesh::Cube();
+            texturesLoaded = cube.texture.init(images[(i + j) % 2], layout) && texturesLoaded;
+            cube.texture.sampler.filter = TextureFilter::Bilinear;
+            cube.texture.sampler.mipmaps = mipmaps;
+            cube.size = {3.0f, 3.0f, 3.0f};
+            cube.position = {((float)i - (WALL_SIDE - 1) * 0.5f) * 3.5f, ((float)j - (WALL_SIDE - 1) * 0.5f) * 3.5f, 0.0f};
+            cube.rotation = {0.3f, 0.4f, M_PIf * 0.5f + 0.2f};
+            addMesh(cube);
+        }
+
+    // Add light
+    Light light;
+    light.direction = {0.3f, -0.5f, -1.0f};
+    light.brightness = 1.0f;
+    addLight(light);
+}
+
+int main()
+{
+    const char *layoutNames[3] = {"Linear", "Tiled", "Morton"};
+    TextureLayout layouts[3] = {TextureLayout::Linear, TextureLayout::Tiled, TextureLayout::Morton};
+
+    for (int mipmaps = 1; mipmaps >= 0; mipmaps--)
+        for (int i = 0; i < 3; i++)
+        {
+            LayoutScene scene(layouts[i], mipmaps);
+            if (!scene.initHeadless(800, 800))
+            {
+                printf("Error initializing engine\n");
+                return 1;
+            }
+            scene.setup();
+            if (!scene.texturesLoaded)
+            {
+                printf("Run from the repository root, textures are read from assets/bmp\n");
+                return 1;
+            }
+
+            for (int f = 0; f < WARMUP_FRAMES; f++)
+                scene.RenderFrame();
+
+            // Best of the timed frames, the least disturbed by the rest of
+            // the machine
+            double best = 1e9, total = 0.0;
+            for (int f = 0; f < TIMED_FRAMES; f++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                scene.RenderFrame();
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                best = std::min(best, ms);
+                total += ms;
+            }
+
+            printf("mipmaps %-3s, %-6s layout: %7.2f ms/frame best, %7.2f average\n",
+                   mipmaps ? "on" : "off", layoutNames[i], best, total / TIMED_FRAMES);
+        }
+
+    return 0;
+}